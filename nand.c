@@ -1,430 +1,2179 @@
+#define _GNU_SOURCE
+#include <sys/sysmacros.h>
 #include "nand.h"
+#include "nand_ring.h"
 
-int nand_erase(const char *device_name, const int offset, const int len) {
+static int mtd_open(const char *device_name, int flags)
+{
+    return open(device_name, flags);
+}
+
+static int mtd_ioctl(int fd, unsigned long request, void *arg)
+{
+    return ioctl(fd, request, arg);
+}
+
+const nand_dev_ops_t nand_mtd_ops = {
+    .open   = mtd_open,
+    .close  = close,
+    .fstat  = fstat,
+    .ioctl  = mtd_ioctl,
+    .lseek  = lseek,
+    .read   = read,
+    .write  = write,
+    .pread  = pread,
+    .pwrite = pwrite,
+};
+
+/* ops used by every nand_* call */
+static const nand_dev_ops_t *dev_ops = &nand_mtd_ops;
+
+void nand_set_dev_ops(const nand_dev_ops_t *ops)
+{
+    dev_ops = ops ? ops : &nand_mtd_ops;
+}
+
+const nand_dev_ops_t *nand_get_dev_ops(void)
+{
+    return dev_ops;
+}
+
+/* flags of sessions opened from now on */
+static unsigned int default_flags = 0;
+
+void nand_set_flags(unsigned int flags)
+{
+    default_flags = flags;
+}
+
+/* progress and error messages of the library, on for the tools */
+static bool verbose = true;
+
+void nand_set_verbose(bool on)
+{
+    verbose = on;
+}
+
+void nand_msg(const char *fmt, ...)
+{
+    va_list ap;
+
+    if (!verbose)
+        return;
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+}
+
+/* buffer aligned to a memory page so the driver can dma straight from it */
+static void *alloc_aligned(size_t size)
+{
+    void *buf;
+    long align = sysconf(_SC_PAGESIZE);
+
+    if (align <= 0)
+        align = 4096;
+    if (posix_memalign(&buf, align, size) != 0)
+        return NULL;
+    return buf;
+}
+
+/* bad block table cache file, used by nand_open when set */
+static const char *bbt_cache_path = NULL;
+
+#define NAND_BBT_MAGIC      0x3242424E      /* "NBB2", 64 bit size */
+
+/* header of the on-disk bad block table, the bitmap words follow it */
+struct nand_bbt_file_hdr
+{
+    uint32_t    magic;
+    uint32_t    erasesize;
+    uint64_t    size;                       /* geometry the table was built for */
+    uint32_t    nblocks;
+    uint32_t    reserved;
+};
+
+void nand_set_bbt_cache(const char *path)
+{
+    bbt_cache_path = path;
+}
+
+/*
+ * MEMGETINFO only has 32 bits for the size, parts of 4GiB and more report it
+ * truncated. The mtd sysfs node has the full size, the simulator's backing
+ * file has it in st_size.
+ */
+static uint64_t device_size(nand_session_t *s, const struct stat *st)
+{
+    uint64_t size = s->meminfo.size;
+    unsigned long long sys_size;
+    char path[64];
+    FILE *pf;
+
+    if (st->st_rdev != 0) {
+        snprintf(path, sizeof(path), "/sys/dev/char/%u:%u/size", major(st->st_rdev), minor(st->st_rdev));
+        pf = fopen(path, "r");
+        if (pf != NULL) {
+            if (fscanf(pf, "%llu", &sys_size) == 1 && sys_size > size)
+                size = sys_size;
+            fclose(pf);
+        }
+    }
+    if (st->st_size > 0 && (uint64_t)st->st_size > size)
+        size = (uint64_t)st->st_size;
+    return size;
+}
+
+nand_session_t *nand_open(const char *device_name)
+{
+    struct stat st;
+    nand_session_t *s;
+
+    s = (nand_session_t *)calloc(1, sizeof(*s));
+    if (s == NULL) {
+        nand_msg("malloc session failed!\n");
+        return NULL;
+    }
+    s->ops = dev_ops;
+    s->flags = default_flags;
+
+    //open mtd device
+    s->fd = s->ops->open(device_name, O_RDWR);
+    if (s->fd < 0) {
+        nand_msg("open %s failed!\n", device_name);
+        free(s);
+        return NULL;
+    }
+
+    //check is a char device
+    if (s->ops->fstat(s->fd, &st) < 0) {
+        nand_msg("fstat %s failed!\n", device_name);
+        goto fail;
+    }
+
+    if (!S_ISCHR(st.st_mode)) {
+        nand_msg("%s: not a char device", device_name);
+        goto fail;
+    }
+
+    //get meminfo
+    if (s->ops->ioctl(s->fd, MEMGETINFO, &s->meminfo) < 0) {
+        nand_msg("get MEMGETINFO failed!\n");
+        goto fail;
+    }
+
+    //scratch page
+    s->page_buf = (uint8_t *)alloc_aligned(s->meminfo.writesize);
+    if (s->page_buf == NULL) {
+        nand_msg("malloc %d size buffer failed!\n", s->meminfo.writesize);
+        goto fail;
+    }
+
+    s->size = device_size(s, &st);
+    s->nblocks = (uint32_t)(s->size / s->meminfo.erasesize);
+
+    //bad block table, from the cache when it matches this device
+    if (bbt_cache_path != NULL && nand_bbt_load(s, bbt_cache_path) < 0) {
+        if (nand_bbt_scan(s) < 0)
+            goto fail;
+        nand_bbt_save(s, bbt_cache_path);
+    }
+
+    return s;
+
+fail:
+    s->ops->close(s->fd);
+    free(s->page_buf);
+    free(s->bbt);
+    free(s->bbt_filled);
+    free(s);
+    return NULL;
+}
+
+void nand_close(nand_session_t *s)
+{
+    if (s == NULL)
+        return;
+
+    s->ops->close(s->fd);
+    free(s->page_buf);
+    free(s->block_buf);
+    free(s->verify_buf);
+    free(s->bbt);
+    free(s->bbt_filled);
+    free(s);
+}
+
+static size_t bbt_words(nand_session_t *s)
+{
+    return (s->nblocks + 31) / 32;
+}
+
+static size_t bbt_filled_words(nand_session_t *s)
+{
+    return (bbt_words(s) + 31) / 32;
+}
+
+/* empty table, every word still to be queried */
+static int bbt_alloc(nand_session_t *s)
+{
+    free(s->bbt);
+    free(s->bbt_filled);
+    s->bbt = (uint32_t *)calloc(bbt_words(s), sizeof(uint32_t));
+    s->bbt_filled = (uint32_t *)calloc(bbt_filled_words(s), sizeof(uint32_t));
+    if (s->bbt == NULL || s->bbt_filled == NULL) {
+        nand_msg("malloc bad block table failed!\n");
+        free(s->bbt);
+        free(s->bbt_filled);
+        s->bbt = s->bbt_filled = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * The table is filled one word (32 eraseblocks) at a time, when a lookup
+ * first needs it, so a short run over a few blocks costs a few
+ * MEMGETBADBLOCK calls instead of one per block of the device.
+ */
+static int bbt_fill(nand_session_t *s, uint32_t word)
+{
+    uint32_t block, end;
+    int ret;
+
+    if (s->bbt == NULL && bbt_alloc(s) < 0)
+        return -1;
+    if ((s->bbt_filled[word / 32] >> (word % 32)) & 1)
+        return 0;
+
+    end = (word + 1) * 32 < s->nblocks ? (word + 1) * 32 : s->nblocks;
+    for (block = word * 32; block < end; block++) {
+        loff_t bpos = (loff_t)block * s->meminfo.erasesize;
+
+        ret = s->ops->ioctl(s->fd, MEMGETBADBLOCK, &bpos);
+        if (ret < 0) {
+            nand_msg("MEMGETBADBLOCK error at 0x%08llx\n", (unsigned long long)bpos);
+            return -1;
+        }
+        if (ret > 0)
+            s->bbt[word] |= 1u << (block % 32);
+    }
+    s->bbt_filled[word / 32] |= 1u << (word % 32);
+    return 0;
+}
+
+/* every word not queried yet */
+static int bbt_fill_all(nand_session_t *s)
+{
+    uint32_t word;
+
+    for (word = 0; word < bbt_words(s); word++) {
+        if (bbt_fill(s, word) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+int nand_bbt_scan(nand_session_t *s)
+{
+    if (bbt_alloc(s) < 0 || bbt_fill_all(s) < 0)
+        return -1;
+    return 0;
+}
+
+int nand_bbt_load(nand_session_t *s, const char *path)
+{
+    struct nand_bbt_file_hdr hdr;
+    uint32_t *bbt;
+    FILE *pf;
+
+    pf = fopen(path, "r");
+    if (pf == NULL)
+        return -1;
+
+    if (fread(&hdr, sizeof(hdr), 1, pf) != 1 || hdr.magic != NAND_BBT_MAGIC ||
+        hdr.size != s->size || hdr.erasesize != s->meminfo.erasesize ||
+        hdr.nblocks != s->nblocks) {
+        nand_msg("bad block table %s does not match the device, rescanning\n", path);
+        fclose(pf);
+        return -1;
+    }
+
+    bbt = (uint32_t *)malloc(bbt_words(s) * sizeof(uint32_t));
+    if (bbt == NULL || fread(bbt, sizeof(uint32_t), bbt_words(s), pf) != bbt_words(s) || bbt_alloc(s) < 0) {
+        free(bbt);
+        fclose(pf);
+        return -1;
+    }
+
+    fclose(pf);
+    free(s->bbt);
+    s->bbt = bbt;
+    memset(s->bbt_filled, 0xFF, bbt_filled_words(s) * sizeof(uint32_t));
+    return 0;
+}
+
+int nand_bbt_save(nand_session_t *s, const char *path)
+{
+    struct nand_bbt_file_hdr hdr;
+    FILE *pf;
+    int ret = 0;
+
+    if (bbt_fill_all(s) < 0)
+        return -1;
+
+    pf = fopen(path, "w");
+    if (pf == NULL) {
+        nand_msg("fopen %s failed!\n", path);
+        return -1;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic       = NAND_BBT_MAGIC;
+    hdr.size        = s->size;
+    hdr.erasesize   = s->meminfo.erasesize;
+    hdr.nblocks     = s->nblocks;
+    if (fwrite(&hdr, sizeof(hdr), 1, pf) != 1 ||
+        fwrite(s->bbt, sizeof(uint32_t), bbt_words(s), pf) != bbt_words(s)) {
+        nand_msg("write bad block table %s failed!\n", path);
+        ret = -1;
+    }
+
+    if (fclose(pf) != 0)
+        ret = -1;
+    return ret;
+}
+
+/* 1 if the eraseblock holding offset is bad, -1 if the table can't be built */
+int nand_block_isbad(nand_session_t *s, uint64_t offset)
+{
+    uint64_t block = offset / s->meminfo.erasesize;
+
+    if (block >= s->nblocks)
+        return 0;
+    if (bbt_fill(s, (uint32_t)(block / 32)) < 0)
+        return -1;
+    return (s->bbt[block / 32] >> (block % 32)) & 1;
+}
+
+int nand_block_erase(nand_session_t *s, uint64_t offset)
+{
+    struct erase_info_user64 erase;
+
+    erase.start = offset & ~(uint64_t)(s->meminfo.erasesize - 1);
+    erase.length = s->meminfo.erasesize;
+    if (s->ops->ioctl(s->fd, MEMERASE64, &erase) < 0) {
+        nand_msg("mtd: erase failure at 0x%08llx\n", (unsigned long long)erase.start);
+        return -1;
+    }
+    return 0;
+}
+
+/* 16 byte vectors, plain SSE2/NEON loads and ands with gcc */
+typedef uint32_t nand_vec_t __attribute__((vector_size(16)));
+
+/* true if every byte is 0xFF, i.e. what an erased page reads back as */
+bool nand_is_erased(const void *buf, size_t len)
+{
+    const uint8_t *p = (const uint8_t *)buf;
+    const nand_vec_t *v;
+    nand_vec_t acc;
+    size_t n;
+
+    while (len > 0 && ((uintptr_t)p & (sizeof(nand_vec_t) - 1))) {
+        if (*p != 0xFF)
+            return false;
+        p++;
+        len--;
+    }
+
+    /* 64 bytes per step, bail out at the first step with a cleared bit */
+    v = (const nand_vec_t *)p;
+    for (n = len / 64; n > 0; n--, v += 4) {
+        acc = v[0] & v[1] & v[2] & v[3];
+        if ((acc[0] & acc[1] & acc[2] & acc[3]) != 0xFFFFFFFF)
+            return false;
+    }
+    p = (const uint8_t *)v;
+    len %= 64;
+
+    while (len > 0) {
+        if (*p != 0xFF)
+            return false;
+        p++;
+        len--;
+    }
+    return true;
+}
+
+static uint8_t *session_block_buf(nand_session_t *s)
+{
+    if (s->block_buf == NULL) {
+        s->block_buf = (uint8_t *)alloc_aligned(s->meminfo.erasesize);
+        if (s->block_buf == NULL)
+            nand_msg("malloc %d size buffer failed!\n", s->meminfo.erasesize);
+    }
+    return s->block_buf;
+}
+
+/*
+ * Blank check of a good block before erasing it. The first page decides for
+ * almost every used block, the rest is only read when that page is blank.
+ */
+static bool block_is_blank(nand_session_t *s, uint64_t blockstart, uint8_t *buf)
+{
+    uint32_t writesize = s->meminfo.writesize;
+    uint32_t rest = s->meminfo.erasesize - writesize;
+
+    if (buf == NULL)
+        return false;
+    if (s->ops->pread(s->fd, buf, writesize, blockstart) != (ssize_t)writesize ||
+        !nand_is_erased(buf, writesize))
+        return false;
+    if (rest == 0)
+        return true;
+    if (s->ops->pread(s->fd, buf, rest, blockstart + writesize) != (ssize_t)rest)
+        return false;
+    return nand_is_erased(buf, rest);
+}
+
+/*
+ * Read back pages just programmed and compare them with the source, which is
+ * still hot in cache. Every mismatching page is reported.
+ */
+static int verify_pages(nand_session_t *s, const uint8_t *buf, size_t len, uint64_t offset)
+{
+    uint32_t writesize = s->meminfo.writesize;
+    ssize_t size;
+    size_t page;
+    int bad = 0;
+
+    if (s->verify_buf == NULL) {
+        s->verify_buf = (uint8_t *)alloc_aligned(s->meminfo.erasesize);
+        if (s->verify_buf == NULL) {
+            nand_msg("malloc %d size buffer failed!\n", s->meminfo.erasesize);
+            return -1;
+        }
+    }
+
+    size = s->ops->pread(s->fd, s->verify_buf, len, offset);
+    if (size != (ssize_t)len) {
+        nand_msg("verify: read err at 0x%08llx, need :%zu, real :%zd\n", (unsigned long long)offset, len, size);
+        return -1;
+    }
+
+    for (page = 0; page < len; page += writesize) {
+        if (memcmp(s->verify_buf + page, buf + page, writesize)) {
+            nand_msg("verify: mismatch in page at 0x%08llx\n", (unsigned long long)(offset + page));
+            bad++;
+        }
+    }
+    return bad ? -1 : 0;
+}
+
+/* program whole pages, with skip_ff only the runs that aren't all 0xFF */
+static int program_runs(nand_session_t *s, const uint8_t *buf, size_t len, uint64_t offset, bool skip_ff)
+{
+    uint32_t writesize = s->meminfo.writesize;
+    size_t start, end;
+    ssize_t size;
+
+    if (!skip_ff)
+        start = 0, end = len;
+    else
+        start = end = 0;
+
+    while (start < len) {
+        if (skip_ff) {
+            for (start = end; start < len && nand_is_erased(buf + start, writesize); start += writesize)
+                ;
+            for (end = start; end < len && !nand_is_erased(buf + end, writesize); end += writesize)
+                ;
+            if (start == end)
+                break;
+        }
+
+        size = s->ops->pwrite(s->fd, buf + start, end - start, offset + start);
+        if (size != (ssize_t)(end - start)) {
+            nand_msg("write err, need :%zu, real :%zd\n", end - start, size);
+            return -1;
+        }
+        start = end;
+    }
+
+    if (s->flags & NAND_F_VERIFY)
+        return verify_pages(s, buf, len, offset);
+    return 0;
+}
+
+/* program whole pages, with NAND_F_SKIP_FF only the runs that aren't all 0xFF */
+static int program_pages(nand_session_t *s, const uint8_t *buf, size_t len, uint64_t offset)
+{
+    return program_runs(s, buf, len, offset, s->flags & NAND_F_SKIP_FF);
+}
+
+/* tail padding of the last page, 0xFF when erased pages are skipped */
+static int pad_byte(nand_session_t *s)
+{
+    return (s->flags & NAND_F_SKIP_FF) ? 0xFF : 0;
+}
+
+
+int nand_session_erase(nand_session_t *s, uint64_t offset, uint64_t len) {
+
+    int ret = 0;
+    uint64_t start;
+
+    /* offset + len must neither wrap nor run past the device */
+    if (offset >= s->size || len > s->size - offset) {
+        nand_msg("erase 0x%08llx+0x%llx past the end of the device (0x%llx)\n", (unsigned long long)offset,
+                 (unsigned long long)len, (unsigned long long)s->size);
+        return -1;
+    }
+ 
+    for (start = offset; start < offset + len; start += s->meminfo.erasesize) {
+        //check bad block
+        ret = nand_block_isbad(s, start);
+        if (ret > 0) {
+            nand_msg("mtd: not erasing bad block at 0x%08llx\n", (unsigned long long)start);
+            continue;  // Don't try to erase known factory-bad blocks.
+        }
+ 
+        if (ret < 0) {
+            nand_msg("bad block table error");
+            return -1;
+        }
+
+        //already erased, don't spend an erase cycle on it
+        if ((s->flags & NAND_F_SKIP_BLANK) && block_is_blank(s, start, session_block_buf(s)))
+            continue;
+ 
+        //erase
+        if (nand_block_erase(s, start) < 0)
+            return -1;
+    }
+ 
+    return 0;
+}
+
+
+static uint64_t next_good_eraseblock(nand_session_t *s, uint64_t block_offset)
+{
+    uint32_t block, word, good;
+
+    if (block_offset >= s->size) {
+        nand_msg("not enough space in MTD device");
+        return block_offset; /* let the caller exit */
+    }
+
+    /* first clear bit at or after the block, one word of blocks per step */
+    block = (uint32_t)(block_offset / s->meminfo.erasesize);
+    word = block / 32;
+    if (block >= s->nblocks) {
+        /* partial block at the end of the device, not in the table */
+        nand_msg("not enough space in MTD device");
+        return s->size;
+    }
+    if (bbt_fill(s, word) < 0)
+        return s->size;
+    good = ~s->bbt[word] & (~0u << (block % 32));
+    while (good == 0 && ++word < bbt_words(s)) {
+        if (bbt_fill(s, word) < 0)
+            return s->size;
+        good = ~s->bbt[word];
+    }
+
+    if (good == 0 || word * 32 + __builtin_ctz(good) >= s->nblocks) {
+        nand_msg("not enough space in MTD device");
+        return s->size;
+    }
+
+    good = word * 32 + __builtin_ctz(good);
+    if (good != block)
+        nand_msg("Skipping bad blocks at 0x%08llx-0x%08llx\n", (unsigned long long)block_offset,
+               (unsigned long long)good * s->meminfo.erasesize - 1);
+    return (uint64_t)good * s->meminfo.erasesize;
+}
+ 
+ 
+/* where the next byte of a sparse image goes, one good eraseblock staged in block_buf */
+struct sparse_out
+{
+    nand_session_t  *s;
+    uint64_t        block;                  /* current good eraseblock */
+    uint32_t        base;                   /* first byte of the block the image covers */
+    uint32_t        fill;                   /* bytes of the block staged or skipped */
+};
+
+/* program what is staged, pages left all 0xFF stay erased */
+static int sparse_flush(struct sparse_out *o)
+{
+    nand_session_t *s = o->s;
+    uint32_t writesize = s->meminfo.writesize;
+    uint32_t len = (o->fill + writesize - 1) & ~(writesize - 1);
+
+    memset(s->block_buf + o->fill, 0xFF, len - o->fill);
+    if (len > o->base && program_runs(s, s->block_buf + o->base, len - o->base, o->block + o->base, true) < 0)
+        return -1;
+    o->base = o->fill = len;
+    return 0;
+}
+
+/* bytes left in the current block, moves on to the next good one when it is full */
+static int32_t sparse_room(struct sparse_out *o)
+{
+    nand_session_t *s = o->s;
+
+    if (o->fill == s->meminfo.erasesize) {
+        if (sparse_flush(o) < 0)
+            return -1;
+        o->block = next_good_eraseblock(s, o->block + s->meminfo.erasesize);
+        if (o->block >= s->size) {
+            nand_msg("offset(%llu) over limit(%llu)\n", (unsigned long long)o->block, (unsigned long long)s->size);
+            return -1;
+        }
+        o->base = o->fill = 0;
+        nand_msg("Writing at 0x%08llx\n", (unsigned long long)o->block);
+    }
+    return s->meminfo.erasesize - o->fill;
+}
+
+/* erased or don't care: whole blocks are passed over without touching them */
+static int sparse_skip(struct sparse_out *o, uint64_t n)
+{
+    int32_t room;
+
+    while (n > 0) {
+        if ((room = sparse_room(o)) < 0)
+            return -1;
+        if ((uint64_t)room > n)
+            room = n;
+        if (o->fill == o->base && room == (int32_t)o->s->meminfo.erasesize)
+            o->base += room;        /* nothing staged, nothing to program */
+        else
+            memset(o->s->block_buf + o->fill, 0xFF, room);
+        o->fill += room;
+        n -= room;
+    }
+    return 0;
+}
+
+static int sparse_fill(struct sparse_out *o, uint32_t pattern, uint64_t n)
+{
+    uint8_t bytes[4];
+    uint64_t i = 0;
+    int32_t room, j;
+
+    if (pattern == 0xFFFFFFFFu)
+        return sparse_skip(o, n);
+
+    memcpy(bytes, &pattern, sizeof(bytes));
+    while (i < n) {
+        if ((room = sparse_room(o)) < 0)
+            return -1;
+        for (j = 0; j < room && i < n; j++, i++)
+            o->s->block_buf[o->fill + j] = bytes[i & 3];
+        o->fill += j;
+    }
+    return 0;
+}
+
+static int sparse_raw(struct sparse_out *o, FILE *pf, uint64_t n)
+{
+    int32_t room;
+
+    while (n > 0) {
+        if ((room = sparse_room(o)) < 0)
+            return -1;
+        if ((uint64_t)room > n)
+            room = n;
+        if (fread(o->s->block_buf + o->fill, 1, room, pf) != (size_t)room) {
+            nand_msg("sparse: raw chunk truncated\n");
+            return -1;
+        }
+        o->fill += room;
+        n -= room;
+    }
+    return 0;
+}
+
+/*
+ * write_file of an Android sparse image, the header is already read. Raw
+ * chunks are staged one eraseblock at a time and programmed in runs, fill
+ * chunks of 0xFF and don't care chunks only move the position on, across
+ * good blocks. Like write_file the flash is expected to be erased.
+ */
+static int write_file_sparse(nand_session_t *s, FILE *pf, uint64_t offset, const nand_sparse_header_t *hdr)
+{
+    nand_sparse_chunk_t chunk;
+    struct sparse_out o;
+    uint64_t total = 0, len;
+    uint32_t pattern, i;
+    uint64_t blockstart = offset & ~(uint64_t)(s->meminfo.erasesize - 1);
+    int ret = 0;
+
+    if (hdr->major_version != 1 || hdr->file_hdr_sz < sizeof(*hdr) || hdr->chunk_hdr_sz < sizeof(chunk) ||
+        hdr->blk_sz == 0 || (hdr->blk_sz & 3)) {
+        nand_msg("sparse: unsupported image, version %u, block size %u\n", hdr->major_version, hdr->blk_sz);
+        return -1;
+    }
+    if (session_block_buf(s) == NULL || fseek(pf, hdr->file_hdr_sz, SEEK_SET) < 0)
+        return -1;
+
+    o.s = s;
+    o.block = next_good_eraseblock(s, blockstart);
+    o.base = o.fill = o.block == blockstart ? (uint32_t)(offset - blockstart) : 0;
+    if (o.block >= s->size) {
+        nand_msg("offset(%llu) over limit(%llu)\n", (unsigned long long)o.block, (unsigned long long)s->size);
+        return -1;
+    }
+    nand_msg("Writing at 0x%08llx\n", (unsigned long long)(o.block + o.base));
+
+    for (i = 0; i < hdr->total_chunks && ret == 0; i++) {
+        if (fread(&chunk, sizeof(chunk), 1, pf) != 1 ||
+            fseek(pf, hdr->chunk_hdr_sz - sizeof(chunk), SEEK_CUR) < 0) {
+            nand_msg("sparse: chunk %u header truncated\n", i);
+            return -1;
+        }
+        len = (uint64_t)chunk.chunk_sz * hdr->blk_sz;
+
+        switch (chunk.chunk_type) {
+        case NAND_SPARSE_RAW:
+            if (chunk.total_sz != hdr->chunk_hdr_sz + len)
+                goto bad_chunk;
+            ret = sparse_raw(&o, pf, len);
+            break;
+
+        case NAND_SPARSE_FILL:
+            if (chunk.total_sz != hdr->chunk_hdr_sz + sizeof(pattern) || fread(&pattern, sizeof(pattern), 1, pf) != 1)
+                goto bad_chunk;
+            ret = sparse_fill(&o, pattern, len);
+            break;
+
+        case NAND_SPARSE_DONT_CARE:
+            if (chunk.total_sz != hdr->chunk_hdr_sz)
+                goto bad_chunk;
+            ret = sparse_skip(&o, len);
+            break;
+
+        case NAND_SPARSE_CRC32:
+            /* checksum of the data so far, nothing to place on flash */
+            if (chunk.total_sz != hdr->chunk_hdr_sz + sizeof(pattern) || fseek(pf, sizeof(pattern), SEEK_CUR) < 0)
+                goto bad_chunk;
+            len = 0;
+            break;
+
+        default:
+            goto bad_chunk;
+        }
+        total += len;
+    }
+
+    if (ret == 0 && total != (uint64_t)hdr->total_blks * hdr->blk_sz) {
+        nand_msg("sparse: chunks cover %llu bytes, header says %llu\n", (unsigned long long)total,
+               (unsigned long long)hdr->total_blks * hdr->blk_sz);
+        ret = -1;
+    }
+    if (ret == 0)
+        ret = sparse_flush(&o);
+    if (ret == 0)
+        nand_msg("write ok!\n");
+    return ret;
+
+bad_chunk:
+    nand_msg("sparse: bad chunk %u, type 0x%04x, %u bytes\n", i, chunk.chunk_type, chunk.total_sz);
+    return -1;
+}
+
+/*
+ * Batched write_file: read up to the end of the current good eraseblock in
+ * one fread and program it with one pwrite. Same layout on flash as the page
+ * loop, the last page is padded and nothing is written after it.
+ */
+static int write_file_batch(nand_session_t *s, FILE *pf, uint64_t offset)
+{
+    mtd_info_t *meminfo = &s->meminfo;
+    uint64_t blockstart;
+    uint64_t limit = s->size;
+    size_t chunk, cnt, len;
+
+    if (session_block_buf(s) == NULL)
+        return -1;
+
+    while (offset < limit) {
+        blockstart = offset & ~(uint64_t)(meminfo->erasesize - 1);
+        if (blockstart == offset) {
+            offset = next_good_eraseblock(s, blockstart);
+            nand_msg("Writing at 0x%08llx\n", (unsigned long long)offset);
+
+            if (offset >= limit) {
+                nand_msg("offset(%llu) over limit(%llu)\n", (unsigned long long)offset, (unsigned long long)limit);
+                return -1;
+            }
+            blockstart = offset;
+        }
+
+        chunk = blockstart + meminfo->erasesize - offset;
+        cnt = fread(s->block_buf, 1, chunk, pf);
+        if (cnt == 0)
+            break;
+
+        /* zero pad to end of write block */
+        len = (cnt + meminfo->writesize - 1) & ~(size_t)(meminfo->writesize - 1);
+        memset(s->block_buf + cnt, pad_byte(s), len - cnt);
+
+        if (program_pages(s, s->block_buf, len, offset) < 0)
+            return -1;
+
+        offset += len;
+        if (cnt < chunk)
+            break;
+    }
+
+    if (ferror(pf)) {
+        nand_msg("read input failed!\n");
+        return -1;
+    }
+
+    nand_msg("write ok!\n");
+    return 0;
+}
+
+/* depth of the write_file pipeline, in eraseblock buffers */
+#define NAND_PIPE_DEPTH     4
+
+struct write_file_reader
+{
+    nand_ring_t     *ring;
+    FILE            *pf;
+    size_t          first;                  /* bytes up to the end of the first block */
+    size_t          writesize;
+    int             pad;
+    int             error;
+};
+
+/*
+ * Producer of the pipelined write_file. Every good block takes a whole
+ * eraseblock of input, except the first one which starts at the offset, so
+ * the chunks can be cut without knowing where the bad blocks are.
+ */
+static void *write_file_reader(void *arg)
+{
+    struct write_file_reader *r = (struct write_file_reader *)arg;
+    size_t chunk = r->first;
+    size_t cnt, len;
+    uint8_t *buf;
+
+    while ((buf = nand_ring_get_free(r->ring)) != NULL) {
+        cnt = fread(buf, 1, chunk, r->pf);
+        if (cnt == 0)
+            break;
+
+        /* pad to end of write block */
+        len = (cnt + r->writesize - 1) & ~(r->writesize - 1);
+        memset(buf + cnt, r->pad, len - cnt);
+        nand_ring_put(r->ring, len);
+
+        if (cnt < chunk)
+            break;
+        chunk = r->ring->bufsize;
+    }
+
+    if (ferror(r->pf)) {
+        nand_msg("read input failed!\n");
+        r->error = -1;
+        nand_ring_abort(r->ring);
+    } else {
+        nand_ring_close(r->ring);
+    }
+    return NULL;
+}
+
+/*
+ * Pipelined write_file: a reader thread fills a ring of eraseblock buffers
+ * from the input while this thread programs the previous ones, so slow input
+ * and flash program time overlap.
+ */
+static int write_file_pipelined(nand_session_t *s, FILE *pf, uint64_t offset)
+{
+    mtd_info_t *meminfo = &s->meminfo;
+    uint64_t blockstart;
+    uint64_t limit = s->size;
+    struct write_file_reader r;
+    nand_ring_t ring;
+    pthread_t reader;
+    uint8_t *buf;
+    size_t len;
+    int ret = 0;
+
+    if (nand_ring_init(&ring, NAND_PIPE_DEPTH, meminfo->erasesize) < 0)
+        return -1;
+
+    r.ring = &ring;
+    r.pf = pf;
+    r.first = meminfo->erasesize - (offset & (meminfo->erasesize - 1));
+    r.writesize = meminfo->writesize;
+    r.pad = pad_byte(s);
+    r.error = 0;
+    if (pthread_create(&reader, NULL, write_file_reader, &r) != 0) {
+        nand_msg("create write_file reader thread failed!\n");
+        nand_ring_destroy(&ring);
+        return -1;
+    }
+
+    while ((buf = nand_ring_get_full(&ring, &len)) != NULL) {
+        blockstart = offset & ~(uint64_t)(meminfo->erasesize - 1);
+        if (blockstart == offset) {
+            offset = next_good_eraseblock(s, blockstart);
+            nand_msg("Writing at 0x%08llx\n", (unsigned long long)offset);
+
+            if (offset >= limit) {
+                nand_msg("offset(%llu) over limit(%llu)\n", (unsigned long long)offset, (unsigned long long)limit);
+                ret = -1;
+                break;
+            }
+        }
+
+        if (program_pages(s, buf, len, offset) < 0) {
+            ret = -1;
+            break;
+        }
+        offset += len;
+        nand_ring_release(&ring);
+    }
+
+    if (ret < 0)
+        nand_ring_abort(&ring);
+    pthread_join(reader, NULL);
+    nand_ring_destroy(&ring);
+
+    if (r.error < 0)
+        ret = -1;
+    if (ret == 0)
+        nand_msg("write ok!\n");
+    return ret;
+}
+
+/*
+ * Delta erase_write_file: every target eraseblock is read back and compared
+ * with what the image puts there (the data, 0xFF after its last page). Equal
+ * blocks are left alone. If only pages that are still erased on flash
+ * differ, and all of them lie after the last programmed page of the block,
+ * just those are programmed: pages must be programmed in ascending order
+ * (MLC/TLC parts forbid going back), and mtd does not check it. Every
+ * other changed block is erased and reprogrammed.
+ */
+static int write_file_delta(nand_session_t *s, FILE *pf, uint64_t offset)
+{
+    mtd_info_t *meminfo = &s->meminfo;
+    uint32_t writesize = meminfo->writesize;
+    uint64_t limit = s->size;
+    unsigned int same = 0, programmed = 0, erased = 0;
+    uint8_t *flash;
+    size_t cnt, len, page, start;
+    size_t first_diff, last_prog;           /* first differing page, end of the last programmed one */
+    bool need_erase, differs, blank;
+    ssize_t size;
+    int ret = 0;
+
+    flash = (uint8_t *)alloc_aligned(meminfo->erasesize);
+    if (flash == NULL) {
+        nand_msg("malloc %d size buffer failed!\n", meminfo->erasesize);
+        return -1;
+    }
+
+    while ((cnt = fread(s->block_buf, 1, meminfo->erasesize, pf)) > 0) {
+        offset = next_good_eraseblock(s, offset);
+        if (offset >= limit) {
+            nand_msg("offset(%llu) over limit(%llu)\n", (unsigned long long)offset, (unsigned long long)limit);
+            ret = -1;
+            break;
+        }
+
+        /* pad to end of write block, the rest of the block reads erased */
+        len = (cnt + writesize - 1) & ~(size_t)(writesize - 1);
+        memset(s->block_buf + cnt, pad_byte(s), len - cnt);
+        memset(s->block_buf + len, 0xFF, meminfo->erasesize - len);
+
+        size = s->ops->pread(s->fd, flash, meminfo->erasesize, offset);
+        if (size != (ssize_t)meminfo->erasesize) {
+            nand_msg("read err, need :%d, real :%zd\n", meminfo->erasesize, size);
+            ret = -1;
+            break;
+        }
+
+        need_erase = differs = false;
+        first_diff = last_prog = 0;
+        for (page = 0; page < meminfo->erasesize && !need_erase; page += writesize) {
+            blank = nand_is_erased(flash + page, writesize);
+            if (!blank)
+                last_prog = page + writesize;
+            if (memcmp(flash + page, s->block_buf + page, writesize)) {
+                if (!differs)
+                    first_diff = page;
+                differs = true;
+                need_erase = !blank;
+            }
+        }
+        /* an erased page below a programmed one can't be programmed in place */
+        if (differs && first_diff < last_prog)
+            need_erase = true;
+
+        if (!differs) {
+            same++;
+        } else if (need_erase) {
+            nand_msg("Erasing and writing at 0x%08llx\n", (unsigned long long)offset);
+            if (nand_block_erase(s, offset) < 0) {
+                ret = -1;
+                break;
+            }
+            if (program_pages(s, s->block_buf, len, offset) < 0) {
+                ret = -1;
+                break;
+            }
+            erased++;
+        } else {
+            /* runs of differing pages, all erased and after the last programmed page */
+            nand_msg("Writing at 0x%08llx\n", (unsigned long long)offset);
+            for (page = 0; page < len && ret == 0; ) {
+                for (; page < len && !memcmp(flash + page, s->block_buf + page, writesize); page += writesize)
+                    ;
+                for (start = page; page < len && memcmp(flash + page, s->block_buf + page, writesize); page += writesize)
+                    ;
+                if (page > start && program_pages(s, s->block_buf + start, page - start, offset + start) < 0)
+                    ret = -1;
+            }
+            if (ret < 0)
+                break;
+            programmed++;
+        }
+
+        if (cnt < meminfo->erasesize)
+            break;
+        offset += meminfo->erasesize;
+    }
+
+    if (ferror(pf)) {
+        nand_msg("read input failed!\n");
+        ret = -1;
+    }
+
+    free(flash);
+    if (ret == 0)
+        nand_msg("delta: %u blocks unchanged, %u programmed, %u erased and programmed\n", same, programmed, erased);
+    return ret;
+}
+
+#define ERASE_AHEAD_NONE    UINT64_MAX
+
+/* eraser thread of erase_write_file, one block request outstanding at a time */
+struct erase_ahead
+{
+    nand_session_t  *s;
+    uint8_t         *blank_buf;             /* own buffer for the blank check */
+    uint64_t        req;                    /* block to erase next, or NONE */
+    uint64_t        done;                   /* highest block erased so far, or NONE */
+    bool            quit;
+    int             error;
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+};
+
+static void *erase_ahead_thread(void *arg)
+{
+    struct erase_ahead *e = (struct erase_ahead *)arg;
+    uint64_t start;
+    int ret;
+
+    pthread_mutex_lock(&e->lock);
+    while (1) {
+        while (!e->quit && e->req == ERASE_AHEAD_NONE)
+            pthread_cond_wait(&e->cond, &e->lock);
+        /*
+         * The writer only quits with a block still queued when it failed,
+         * programming stopped before that block, so it is left as it is.
+         */
+        if (e->quit) {
+            e->req = ERASE_AHEAD_NONE;
+            pthread_cond_broadcast(&e->cond);
+            break;
+        }
+
+        start = e->req;
+        pthread_mutex_unlock(&e->lock);
+
+        ret = 0;
+        if (!(e->s->flags & NAND_F_SKIP_BLANK) || !block_is_blank(e->s, start, e->blank_buf))
+            ret = nand_block_erase(e->s, start);
+
+        pthread_mutex_lock(&e->lock);
+        if (ret < 0)
+            e->error = -1;
+        e->done = start;
+        e->req = ERASE_AHEAD_NONE;
+        pthread_cond_broadcast(&e->cond);
+    }
+    pthread_mutex_unlock(&e->lock);
+    return NULL;
+}
+
+/* queue a block, waits until the eraser took the previous one */
+static void erase_ahead_request(struct erase_ahead *e, uint64_t blockstart)
+{
+    pthread_mutex_lock(&e->lock);
+    while (e->req != ERASE_AHEAD_NONE)
+        pthread_cond_wait(&e->cond, &e->lock);
+    e->req = blockstart;
+    pthread_cond_broadcast(&e->cond);
+    pthread_mutex_unlock(&e->lock);
+}
+
+static int erase_ahead_wait(struct erase_ahead *e, uint64_t blockstart)
+{
+    int ret;
+
+    pthread_mutex_lock(&e->lock);
+    /* blocks are erased in ascending order, the eraser may already be past this one */
+    while (e->error == 0 && (e->done == ERASE_AHEAD_NONE || e->done < blockstart))
+        pthread_cond_wait(&e->cond, &e->lock);
+    ret = e->error;
+    pthread_mutex_unlock(&e->lock);
+    return ret;
+}
+
+/*
+ * Erase and write an image in one pass. The next good eraseblock is erased on
+ * a second thread while the current one is programmed, so the erase and
+ * program passes overlap instead of adding up. Only the blocks the image
+ * lands in are erased, the offset has to be eraseblock aligned. With
+ * NAND_F_DELTA only the blocks that differ from the image are touched.
+ */
+int nand_session_erase_write_file(nand_session_t *s, const char *file_name, uint64_t mtd_offset) {
+
+    mtd_info_t *meminfo = &s->meminfo;
+    uint64_t limit = s->size;
+    uint64_t offset = mtd_offset;
+    uint64_t next;
+    struct erase_ahead e;
+    pthread_t eraser;
+    size_t cnt, len;
+    bool more;
+    int c;
+    int ret = 0;
+    FILE *pf;
+
+    if (offset & (meminfo->erasesize - 1)) {
+        nand_msg("start address is not eraseblock aligned");
+        return -1;
+    }
+
+    if (session_block_buf(s) == NULL)
+        return -1;
+
+    pf = fopen(file_name, "r");
+    if (pf == NULL) {
+        nand_msg("fopen %s failed!\n", file_name);
+        return -1;
+    }
+
+    if (s->flags & NAND_F_DELTA) {
+        ret = write_file_delta(s, pf, offset);
+        fclose(pf);
+        if (ret == 0)
+            nand_msg("write ok!\n");
+        return ret;
+    }
+
+    memset(&e, 0, sizeof(e));
+    e.s = s;
+    e.req = e.done = ERASE_AHEAD_NONE;
+    if ((s->flags & NAND_F_SKIP_BLANK) && (e.blank_buf = (uint8_t *)alloc_aligned(meminfo->erasesize)) == NULL) {
+        nand_msg("malloc %d size buffer failed!\n", meminfo->erasesize);
+        fclose(pf);
+        return -1;
+    }
+    pthread_mutex_init(&e.lock, NULL);
+    pthread_cond_init(&e.cond, NULL);
+    if (pthread_create(&eraser, NULL, erase_ahead_thread, &e) != 0) {
+        nand_msg("create eraser thread failed!\n");
+        ret = -1;
+        goto out;
+    }
+
+    offset = next_good_eraseblock(s, offset);
+    if (offset >= limit) {
+        nand_msg("offset(%llu) over limit(%llu)\n", (unsigned long long)offset, (unsigned long long)limit);
+        ret = -1;
+    } else {
+        erase_ahead_request(&e, offset);
+    }
+
+    while (ret == 0) {
+        nand_msg("Writing at 0x%08llx\n", (unsigned long long)offset);
+
+        cnt = fread(s->block_buf, 1, meminfo->erasesize, pf);
+        if (cnt == 0)
+            break;
+
+        /* pad to end of write block */
+        len = (cnt + meminfo->writesize - 1) & ~(size_t)(meminfo->writesize - 1);
+        memset(s->block_buf + cnt, pad_byte(s), len - cnt);
+
+        /* more input means the next good block is needed, start erasing it now */
+        more = false;
+        if (cnt == meminfo->erasesize && (c = getc(pf)) != EOF) {
+            ungetc(c, pf);
+            more = true;
+        }
+        next = limit;
+        if (more) {
+            next = next_good_eraseblock(s, offset + meminfo->erasesize);
+            if (next < limit)
+                erase_ahead_request(&e, next);
+        }
+
+        if (erase_ahead_wait(&e, offset) < 0 || program_pages(s, s->block_buf, len, offset) < 0) {
+            ret = -1;
+            break;
+        }
+
+        if (!more)
+            break;
+        if (next >= limit) {
+            nand_msg("offset(%llu) over limit(%llu)\n", (unsigned long long)next, (unsigned long long)limit);
+            ret = -1;
+            break;
+        }
+        offset = next;
+    }
+
+    if (ferror(pf)) {
+        nand_msg("read input failed!\n");
+        ret = -1;
+    }
+
+    pthread_mutex_lock(&e.lock);
+    e.quit = true;
+    pthread_cond_broadcast(&e.cond);
+    pthread_mutex_unlock(&e.lock);
+    pthread_join(eraser, NULL);
+
+out:
+    pthread_mutex_destroy(&e.lock);
+    pthread_cond_destroy(&e.cond);
+    free(e.blank_buf);
+    fclose(pf);
+    if (ret == 0)
+        nand_msg("write ok!\n");
+    return ret;
+}
+
+int nand_session_write_file(nand_session_t *s, const char *file_name, uint64_t mtd_offset) {
+ 
+    mtd_info_t *meminfo = &s->meminfo;
+    uint64_t blockstart;
+    uint64_t limit = 0;
+    size_t cnt = 0;
+    ssize_t size = 0;
+    uint64_t offset = mtd_offset;
+    char *tmp = (char *)s->page_buf;
+ 
+    //fopen input file
+    FILE *pf = fopen(file_name, "r");
+    if (pf==NULL) {
+        nand_msg("fopen %s failed!\n", file_name);
+        return -1;
+    }
+ 
+    limit = s->size;
+ 
+    //check offset page aligned
+    if (offset & (meminfo->writesize - 1)) {
+        nand_msg("start address is not page aligned");
+        fclose(pf);
+        return -1;
+    }
+ 
+    //if offset in a bad block, get next good block
+    blockstart = offset & ~(uint64_t)(meminfo->erasesize - 1);
+    if (offset != blockstart) {
+        uint64_t tmp;
+        tmp = next_good_eraseblock(s, blockstart);
+        if (tmp != blockstart) {
+            offset = tmp;
+        }
+    }
+
+    /* sparse images are recognised by their magic, seekable inputs only */
+    if (fseek(pf, 0, SEEK_CUR) == 0) {
+        nand_sparse_header_t hdr;
+
+        if (fread(&hdr, sizeof(hdr), 1, pf) == 1 && hdr.magic == NAND_SPARSE_MAGIC) {
+            int ret = write_file_sparse(s, pf, offset, &hdr);
+
+            fclose(pf);
+            return ret;
+        }
+        rewind(pf);
+    }
+
+    if (s->flags & (NAND_F_BATCH | NAND_F_PIPELINE)) {
+        int ret = (s->flags & NAND_F_PIPELINE) ? write_file_pipelined(s, pf, offset) :
+                                                 write_file_batch(s, pf, offset);
+
+        fclose(pf);
+        return ret;
+    }
+ 
+    while(offset < limit) {
+        blockstart = offset & ~(uint64_t)(meminfo->erasesize - 1);
+        if (blockstart == offset) {
+            offset = next_good_eraseblock(s, blockstart);
+            nand_msg("Writing at 0x%08llx\n", (unsigned long long)offset);
+ 
+            if (offset >= limit) {
+                nand_msg("offset(%llu) over limit(%llu)\n", (unsigned long long)offset, (unsigned long long)limit);
+                fclose(pf);
+                return -1;
+            }
+        }
+ 
+        s->ops->lseek(s->fd, offset, SEEK_SET);
+ 
+        cnt = fread(tmp, 1, meminfo->writesize, pf);
+        if (cnt == 0) {
+            nand_msg("write ok!\n");
+            break;
+        }
+ 
+        if (cnt < meminfo->writesize) {
+            /* zero pad to end of write block */
+            memset(tmp + cnt, pad_byte(s), meminfo->writesize - cnt);
+        }
+
+        if ((s->flags & NAND_F_SKIP_FF) && nand_is_erased(tmp, meminfo->writesize))
+            size = meminfo->writesize;  /* nothing to program */
+        else
+            size = s->ops->write(s->fd, tmp, meminfo->writesize);
+        if (size != (ssize_t)meminfo->writesize) {
+            nand_msg("write err, need :%u, real :%zd\n", meminfo->writesize, size);
+            fclose(pf);
+            return -1;
+        }
+
+        if ((s->flags & NAND_F_VERIFY) && verify_pages(s, (uint8_t *)tmp, meminfo->writesize, offset) < 0) {
+            fclose(pf);
+            return -1;
+        }
+ 
+        offset += meminfo->writesize;
+ 
+        if (cnt < meminfo->writesize) {
+            nand_msg("write ok!\n");
+            break;
+        }
+    }
+ 
+    fclose(pf);
+ 
+    return 0;//test
+ 
+}
+
+int nand_session_write(nand_session_t *s, const void * data, size_t size, uint64_t mtd_offset) {
+ 
+    mtd_info_t *meminfo = &s->meminfo;
+    uint64_t blockstart;
+    uint64_t limit = 0;
+    size_t cnt = 0;
+    uint64_t offset = mtd_offset;
+    const uint8_t *local_ptr = (const uint8_t *)data;
+    uint8_t *tmp = s->page_buf;
+ 
+    limit = s->size;
+    nand_msg("limit: %llu bytes", (unsigned long long)limit);
+ 
+    //check offset page aligned
+    if (offset & (meminfo->writesize - 1)) {
+        nand_msg("start address is not page aligned");
+        return -1;
+    }
+ 
+    //if offset in a bad block, get next good block
+    blockstart = offset & ~(uint64_t)(meminfo->erasesize - 1);
+    if (offset != blockstart) {
+        uint64_t tmp;
+        tmp = next_good_eraseblock(s, blockstart);
+        if (tmp != blockstart) {
+            offset = tmp;
+        }
+    }
+ 
+    /*
+     * write process: whole pages are programmed straight from the caller
+     * buffer, one pwrite per run of pages up to the end of the good block.
+     * Only a trailing partial page goes through the scratch page.
+     */
+    while(offset < limit) {
+        blockstart = offset & ~(uint64_t)(meminfo->erasesize - 1);
+        if (blockstart == offset) {
+            offset = next_good_eraseblock(s, blockstart);
+            nand_msg("Writing at 0x%08llx\n", (unsigned long long)offset);
+ 
+            if (offset >= limit) {
+                nand_msg("offset(%llu) over limit(%llu)\n", (unsigned long long)offset, (unsigned long long)limit);
+                return -1;
+            }
+            blockstart = offset;
+        }
+
+        if (size >= meminfo->writesize) {
+            cnt = blockstart + meminfo->erasesize - offset;
+            if (cnt > (size & ~(size_t)(meminfo->writesize - 1)))
+                cnt = size & ~(size_t)(meminfo->writesize - 1);
+
+            if (program_pages(s, local_ptr, cnt, offset) < 0)
+                return -1;
+            offset += cnt;
+        } else {
+            /* zero pad to end of write block */
+            cnt = size;
+            memcpy(tmp, local_ptr, cnt);
+            memset(tmp + cnt, pad_byte(s), meminfo->writesize - cnt);
+
+            if (program_pages(s, tmp, meminfo->writesize, offset) < 0)
+                return -1;
+            offset += meminfo->writesize;
+        }
+ 
+        local_ptr += cnt;
+        size -= cnt;
+ 
+        if (size == 0) {
+            nand_msg("write ok!\n");
+            break;
+        }
+    }
+
+    if (size > 0) {
+        nand_msg("offset(%llu) over limit(%llu)\n", (unsigned long long)offset, (unsigned long long)limit);
+        return -1;
+    }
+ 
+    return 0;//test
+ 
+}
+
+
+int nand_session_dump(nand_session_t *s, void * buffer, size_t size, uint64_t mtd_offset){
+    
+    mtd_info_t *meminfo = &s->meminfo;
+    uint64_t blockstart;
+    uint64_t limit = 0;
+    ssize_t size_read = 0;
+    uint64_t offset = mtd_offset;
+    int size_copy = 0;
+    uint8_t *local_ptr = (uint8_t *)buffer;
+    char *temp_space = (char *)s->page_buf;
+
+    limit = s->size;
+    nand_msg("limit: %llu bytes", (unsigned long long)limit);
+
+    //check offset page aligned
+    if (offset & (meminfo->writesize - 1)) {
+        nand_msg("start address is not page aligned");
+        return -1;
+    }
+
+    //if offset in a bad block, stop read
+    blockstart = offset & ~(uint64_t)(meminfo->erasesize - 1);
+
+    if(blockstart >= limit || size > limit - offset)
+    {
+        nand_msg("not enough space in MTD device");
+        return -1;
+    }
+
+
+    if (nand_block_isbad(s, blockstart) < 0)
+    {
+        nand_msg("bad block at 0x%08llx, dump failed\n", (unsigned long long)blockstart);
+        return -1;
+    }
+
+
+    /*
+     * dump process: whole pages go straight into the caller buffer, one pread
+     * per run of pages up to the end of the good block. Only a trailing
+     * partial page goes through the scratch page.
+     */
+    while(size > 0 && offset < limit)
+    {
+        blockstart = offset & ~(uint64_t)(meminfo->erasesize - 1);
+        if (blockstart == offset) {
+            offset = next_good_eraseblock(s, blockstart);
+            nand_msg("reading from block at 0x%08llx\n", (unsigned long long)offset);
+ 
+            if (offset >= limit) {
+                nand_msg("offset(%llu) over limit(%llu)\n", (unsigned long long)offset, (unsigned long long)limit);
+                return -1;
+            }
+            blockstart = offset;
+        }
+
+        if (size >= meminfo->writesize) {
+            size_copy = blockstart + meminfo->erasesize - offset;
+            if ((size_t)size_copy > (size & ~(size_t)(meminfo->writesize - 1)))
+                size_copy = size & ~(size_t)(meminfo->writesize - 1);
+
+            size_read = s->ops->pread(s->fd, local_ptr, size_copy, offset);
+            if (size_read != size_copy)
+            {
+                nand_msg("read err, need :%d, real :%zd\n", size_copy, size_read);
+                return -1;
+            }
+        } else {
+            size_read = s->ops->pread(s->fd, temp_space, meminfo->writesize, offset);
+            if (size_read != (ssize_t)meminfo->writesize)
+            {
+                nand_msg("read err, need :%u, real :%zd\n", meminfo->writesize, size_read);
+                return -1;
+            }
+
+            /* copy the partial last page into the RAM buffer */
+            size_copy = size;
+            memcpy(local_ptr, temp_space, size_copy);
+            size_read = meminfo->writesize;
+        }
+
+        local_ptr += size_copy;
+        size -= size_copy;
+        offset += size_read;
+    }
+
+    if (size > 0) {
+        nand_msg("offset(%llu) over limit(%llu)\n", (unsigned long long)offset, (unsigned long long)limit);
+        return -1;
+    }
+
+    nand_msg("read done!\n");
+    return 0;
+}
+
+
+struct dump_file_writer
+{
+    nand_ring_t     *ring;
+    int             fd;
+    int             error;
+    unsigned int    flags;                  /* NAND_F_DUMP_HOLES or NAND_F_DUMP_SPARSE of the session */
+    uint32_t        writesize;
+    off_t           pos;                    /* file offset the next bytes go to */
+    /* sparse output: chunk being built, totals for the file header */
+    uint16_t        run_type;               /* NAND_SPARSE_RAW or _FILL, 0 before the first page */
+    uint32_t        run_pages;
+    off_t           run_hdr;                /* file offset of the raw chunk header */
+    uint32_t        chunks;
+    uint32_t        blocks;
+};
+
+static int dump_pwrite(struct dump_file_writer *w, const void *buf, size_t len, off_t pos)
+{
+    const uint8_t *p = (const uint8_t *)buf;
+    ssize_t size;
+
+    while (len > 0) {
+        size = pwrite(w->fd, p, len, pos);
+        if (size < 0 && errno == EINTR)
+            continue;
+        if (size <= 0) {
+            nand_msg("write dump file failed, errno %d\n", errno);
+            return -1;
+        }
+        p += size;
+        pos += size;
+        len -= size;
+    }
+    return 0;
+}
+
+/* close the chunk being built, raw data is already in the file behind its header */
+static int dump_sparse_end_run(struct dump_file_writer *w)
+{
+    struct {
+        nand_sparse_chunk_t chunk;
+        uint32_t            pattern;
+    } fill;
+
+    if (w->run_type == 0)
+        return 0;
+
+    fill.chunk.chunk_type = w->run_type;
+    fill.chunk.reserved1 = 0;
+    fill.chunk.chunk_sz = w->run_pages;
+    if (w->run_type == NAND_SPARSE_RAW) {
+        fill.chunk.total_sz = sizeof(fill.chunk) + (uint64_t)w->run_pages * w->writesize;
+        if (dump_pwrite(w, &fill.chunk, sizeof(fill.chunk), w->run_hdr) < 0)
+            return -1;
+    } else {
+        fill.chunk.total_sz = sizeof(fill);
+        fill.pattern = 0xFFFFFFFFu;
+        if (dump_pwrite(w, &fill, sizeof(fill), w->pos) < 0)
+            return -1;
+        w->pos += sizeof(fill);
+    }
+
+    w->chunks++;
+    w->blocks += w->run_pages;
+    w->run_type = 0;
+    return 0;
+}
+
+/*
+ * Write one buffer, erased pages become holes or sparse fill chunks. The
+ * blank check is the vector scan of nand_is_erased.
+ */
+static int dump_pages(struct dump_file_writer *w, const uint8_t *buf, size_t len)
+{
+    size_t page, n;
+    bool erased;
+
+    for (page = 0; page < len; page += n) {
+        n = len - page < w->writesize ? len - page : w->writesize;
+        erased = nand_is_erased(buf + page, n);
+
+        if (w->flags & NAND_F_DUMP_HOLES) {
+            /* never written, the final ftruncate leaves it a hole */
+            if (!erased && dump_pwrite(w, buf + page, n, w->pos) < 0)
+                return -1;
+            w->pos += n;
+            continue;
+        }
+
+        /*
+         * sparse dumps are whole pages, one page is one block of the image.
+         * total_sz of a raw chunk is 32 bit, a run that would overflow it
+         * goes on in a new chunk.
+         */
+        if (w->run_type != (erased ? NAND_SPARSE_FILL : NAND_SPARSE_RAW) ||
+            (!erased && (uint64_t)(w->run_pages + 1) * w->writesize > UINT32_MAX - sizeof(nand_sparse_chunk_t))) {
+            if (dump_sparse_end_run(w) < 0)
+                return -1;
+            w->run_type = erased ? NAND_SPARSE_FILL : NAND_SPARSE_RAW;
+            w->run_pages = 0;
+            if (!erased) {
+                w->run_hdr = w->pos;
+                w->pos += sizeof(nand_sparse_chunk_t);
+            }
+        }
+        if (!erased) {
+            if (dump_pwrite(w, buf + page, n, w->pos) < 0)
+                return -1;
+            w->pos += n;
+        }
+        w->run_pages++;
+    }
+    return 0;
+}
+
+/* drains the ring into the output file while the next block is read */
+static void *dump_file_writer(void *arg)
+{
+    struct dump_file_writer *w = (struct dump_file_writer *)arg;
+    uint8_t *buf;
+    size_t len;
+    int ret;
+
+    while ((buf = nand_ring_get_full(w->ring, &len)) != NULL) {
+        if (w->flags & (NAND_F_DUMP_HOLES | NAND_F_DUMP_SPARSE))
+            ret = dump_pages(w, buf, len);
+        else if ((ret = dump_pwrite(w, buf, len, w->pos)) == 0)
+            w->pos += len;
+
+        if (ret < 0) {
+            w->error = -1;
+            nand_ring_abort(w->ring);
+            return NULL;
+        }
+        nand_ring_release(w->ring);
+    }
+    return NULL;
+}
 
-    int fd;
+/* finish a sparse dump: last chunk, then the file header in front of the chunks */
+static int dump_sparse_finish(struct dump_file_writer *w)
+{
+    nand_sparse_header_t hdr;
+
+    if (dump_sparse_end_run(w) < 0)
+        return -1;
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = NAND_SPARSE_MAGIC;
+    hdr.major_version = 1;
+    hdr.file_hdr_sz = sizeof(hdr);
+    hdr.chunk_hdr_sz = sizeof(nand_sparse_chunk_t);
+    hdr.blk_sz = w->writesize;
+    hdr.total_blks = w->blocks;
+    hdr.total_chunks = w->chunks;
+    return dump_pwrite(w, &hdr, sizeof(hdr), 0);
+}
+
+/*
+ * Stream a dump into a file with two eraseblock buffers: one is read from
+ * flash while the other is written out. A size <= 0 dumps every good block
+ * up to the end of the device. With NAND_F_DUMP_HOLES erased pages are left
+ * as holes, which read back as 0x00, not 0xFF. With NAND_F_DUMP_SPARSE the
+ * file is an Android sparse image with one block per page, erased runs
+ * become 0xFF fill chunks and the size is rounded up to whole pages.
+ */
+int nand_session_dump_file(nand_session_t *s, const char *file_name, int64_t size, uint64_t mtd_offset) {
+
+    mtd_info_t *meminfo = &s->meminfo;
+    uint64_t blockstart;
+    uint64_t limit = s->size;
+    uint64_t offset = mtd_offset;
+    bool to_end = size <= 0;
+    uint64_t remaining;
+    uint64_t written = 0;
+    size_t len;
+    ssize_t size_read;
+    uint8_t *buf;
+    nand_ring_t ring;
+    pthread_t writer;
+    struct dump_file_writer w;
     int ret = 0;
-    struct stat st;
-    mtd_info_t meminfo;
-    erase_info_t erase;
- 
-    //open mtd device
-    fd = open(device_name, O_RDWR);
-    if (fd < 0) {
-        printf("open %s failed!\n", device_name);
+
+    //check offset page aligned
+    if (offset & (meminfo->writesize - 1)) {
+        nand_msg("start address is not page aligned");
         return -1;
     }
- 
-    //check is a char device
-    ret = fstat(fd, &st);
-    if (ret < 0) {
-        printf("fstat %s failed!\n", device_name);
-        close(fd);
+
+    if (offset >= limit) {
+        nand_msg("offset(%llu) over limit(%llu)\n", (unsigned long long)offset, (unsigned long long)limit);
         return -1;
     }
- 
-    if (!S_ISCHR(st.st_mode)) {
-        printf("%s: not a char device", device_name);
-        close(fd);
+    remaining = to_end ? limit - offset : (uint64_t)size;
+    if (s->flags & NAND_F_DUMP_SPARSE)
+        remaining = (remaining + meminfo->writesize - 1) & ~(uint64_t)(meminfo->writesize - 1);
+
+    memset(&w, 0, sizeof(w));
+    w.flags = s->flags & (NAND_F_DUMP_HOLES | NAND_F_DUMP_SPARSE);
+    w.writesize = meminfo->writesize;
+    if (w.flags & NAND_F_DUMP_SPARSE) {
+        w.flags = NAND_F_DUMP_SPARSE;       /* takes precedence over holes */
+        w.pos = sizeof(nand_sparse_header_t);
+    }
+    w.fd = open(file_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (w.fd < 0) {
+        nand_msg("open %s failed!\n", file_name);
         return -1;
     }
- 
-    //get meminfo
-    ret = ioctl(fd, MEMGETINFO, &meminfo);
-    if (ret < 0) {
-        printf("get MEMGETINFO failed!\n");
-        close(fd);
+
+    /* reserve the space up front, trimmed to what was dumped at the end, holes stay unallocated */
+    if (w.flags == 0)
+        fallocate(w.fd, 0, 0, (off_t)remaining);
+
+    if (nand_ring_init(&ring, 2, meminfo->erasesize) < 0) {
+        close(w.fd);
         return -1;
     }
- 
-    erase.length = meminfo.erasesize;
- 
-    for (erase.start = offset; erase.start < offset + len; erase.start += meminfo.erasesize) {
-        loff_t bpos = erase.start;
- 
-        //check bad block
-        ret = ioctl(fd, MEMGETBADBLOCK, &bpos);
-        if (ret > 0) {
-            printf("mtd: not erasing bad block at 0x%08llx\n", bpos);
-            continue;  // Don't try to erase known factory-bad blocks.
+    w.ring = &ring;
+    if (pthread_create(&writer, NULL, dump_file_writer, &w) != 0) {
+        nand_msg("create dump writer thread failed!\n");
+        nand_ring_destroy(&ring);
+        close(w.fd);
+        return -1;
+    }
+
+    while (remaining > 0 && offset < limit) {
+        blockstart = offset & ~(uint64_t)(meminfo->erasesize - 1);
+        if (blockstart == offset) {
+            offset = next_good_eraseblock(s, blockstart);
+            nand_msg("reading from block at 0x%08llx\n", (unsigned long long)offset);
+
+            if (offset >= limit)
+                break;
+            blockstart = offset;
         }
- 
-        if (ret < 0) {
-            printf("MEMGETBADBLOCK error");
-            close(fd);
-            return -1;
+
+        len = blockstart + meminfo->erasesize - offset;
+        if (len > remaining)
+            len = (remaining + meminfo->writesize - 1) & ~(meminfo->writesize - 1);
+
+        buf = nand_ring_get_free(&ring);
+        if (buf == NULL) {
+            ret = -1;
+            break;
         }
- 
-        //erase
-        if (ioctl(fd, MEMERASE, &erase) < 0) {
-            printf("mtd: erase failure at 0x%08llx\n", bpos);
-            close(fd);
-            return -1;
+
+        size_read = s->ops->pread(s->fd, buf, len, offset);
+        if (size_read != (ssize_t)len) {
+            nand_msg("read err, need :%zu, real :%zd\n", len, size_read);
+            ret = -1;
+            break;
         }
+
+        if (len > remaining)
+            len = remaining;
+        nand_ring_put(&ring, len);
+        remaining -= len;
+        written += len;
+        offset += size_read;
     }
- 
-    close(fd);
-    return 0;
+
+    if (ret == 0 && remaining > 0 && !to_end) {
+        nand_msg("offset(%llu) over limit(%llu)\n", (unsigned long long)offset, (unsigned long long)limit);
+        ret = -1;
+    }
+
+    if (ret < 0)
+        nand_ring_abort(&ring);
+    else
+        nand_ring_close(&ring);
+    pthread_join(writer, NULL);
+    nand_ring_destroy(&ring);
+
+    if (w.error < 0)
+        ret = -1;
+    if (ret == 0 && (w.flags & NAND_F_DUMP_SPARSE) && dump_sparse_finish(&w) < 0)
+        ret = -1;
+    if (ftruncate(w.fd, w.pos) < 0 || close(w.fd) < 0) {
+        nand_msg("close %s failed!\n", file_name);
+        ret = -1;
+    }
+
+    if (ret == 0)
+        nand_msg("dump %llu bytes to %s done!\n", (unsigned long long)written, file_name);
+    return ret;
 }
 
+/*
+ * Page + OOB images, laid out like nanddump -o: every page is writesize bytes
+ * of main area followed by oobsize bytes of OOB. A page and its OOB move in
+ * one MEMWRITE/MEMREAD, mode is MTD_OPS_PLACE_OOB, MTD_OPS_AUTO_OOB or
+ * MTD_OPS_RAW (no ECC, for images that already carry it).
+ */
 
-static unsigned next_good_eraseblock(int fd, struct mtd_info_user *meminfo, unsigned block_offset)
+/* OOB bytes moved per page, auto placement only covers the free bytes */
+static uint32_t oob_len(nand_session_t *s, int mode)
 {
-    while (1) {
-        loff_t offs;
- 
-        if (block_offset >= meminfo->size) {
-            printf("not enough space in MTD device");
-            return block_offset; /* let the caller exit */
-        }
- 
-        offs = block_offset;
-        if (ioctl(fd, MEMGETBADBLOCK, &offs) == 0)
-            return block_offset;
- 
-        /* ioctl returned 1 => "bad block" */
-        printf("Skipping bad block at 0x%08x\n", block_offset);
-        block_offset += meminfo->erasesize;
-    }
+    struct nand_ecclayout_user layout;
+
+    if (mode == MTD_OPS_AUTO_OOB && s->ops->ioctl(s->fd, ECCGETLAYOUT, &layout) == 0 &&
+        layout.oobavail <= s->meminfo.oobsize)
+        return layout.oobavail;
+    return s->meminfo.oobsize;
 }
- 
- 
-int nand_write_file(const char *device_name, const char *file_name, const int mtd_offset) {
- 
-    mtd_info_t meminfo;
-    unsigned int blockstart;
-    unsigned int limit = 0;
-    int cnt = -1;
-    int size = 0;
-    int ret = 0;
-    int offset = mtd_offset;
- 
-    //fopen input file
-    FILE *pf = fopen(file_name, "r");
-    if (pf==NULL) {
-        printf("fopen %s failed!\n", file_name);
+
+static int program_page_oob(nand_session_t *s, const uint8_t *data, const uint8_t *oob,
+                            uint32_t ooblen, uint64_t offset, int mode)
+{
+    struct mtd_write_req req;
+
+    memset(&req, 0, sizeof(req));
+    req.start = offset;
+    req.len = s->meminfo.writesize;
+    req.ooblen = ooblen;
+    req.usr_data = (uintptr_t)data;
+    req.usr_oob = ooblen ? (uintptr_t)oob : 0;
+    req.mode = mode;
+    if (s->ops->ioctl(s->fd, MEMWRITE, &req) < 0) {
+        nand_msg("mtd: page+oob write failure at 0x%08llx\n", (unsigned long long)offset);
         return -1;
     }
- 
-    //open mtd device
-    int fd = open(device_name, O_RDWR);
-    if (fd < 0) {
-        printf("open %s failed!\n", device_name);
-        fclose(pf);
+    return 0;
+}
+
+static int read_page_oob(nand_session_t *s, uint8_t *data, uint8_t *oob,
+                         uint32_t ooblen, uint64_t offset, int mode)
+{
+    struct mtd_read_req req;
+
+    memset(&req, 0, sizeof(req));
+    req.start = offset;
+    req.len = s->meminfo.writesize;
+    req.ooblen = ooblen;
+    req.usr_data = (uintptr_t)data;
+    req.usr_oob = ooblen ? (uintptr_t)oob : 0;
+    req.mode = mode;
+    if (s->ops->ioctl(s->fd, MEMREAD, &req) < 0) {
+        nand_msg("mtd: page+oob read failure at 0x%08llx\n", (unsigned long long)offset);
         return -1;
     }
- 
-    //get meminfo
-    ret = ioctl(fd, MEMGETINFO, &meminfo);
-    if (ret < 0) {
-        printf("get MEMGETINFO failed!\n");
-        fclose(pf);
-        close(fd);
+    return 0;
+}
+
+int nand_session_write_oob_file(nand_session_t *s, const char *file_name, uint64_t mtd_offset, int mode) {
+
+    mtd_info_t *meminfo = &s->meminfo;
+    uint64_t limit = s->size;
+    uint64_t offset = mtd_offset;
+    uint64_t blockstart;
+    uint32_t ooblen = oob_len(s, mode);
+    size_t reclen = meminfo->writesize + meminfo->oobsize;
+    uint8_t *rec, *readback = NULL;
+    size_t cnt;
+    int ret = 0;
+    FILE *pf;
+
+    //check offset page aligned
+    if (offset & (meminfo->writesize - 1)) {
+        nand_msg("start address is not page aligned");
         return -1;
     }
- 
-    limit = meminfo.size;
- 
-    //check offset page aligned
-    if (offset & (meminfo.writesize - 1)) {
-        printf("start address is not page aligned");
-        fclose(pf);
-        close(fd);
+
+    pf = fopen(file_name, "r");
+    if (pf == NULL) {
+        nand_msg("fopen %s failed!\n", file_name);
         return -1;
     }
- 
-    //malloc buffer for read 
-    char *tmp = (char *)malloc(meminfo.writesize);
-    if (tmp == NULL) {
-        printf("malloc %d size buffer failed!\n", meminfo.writesize);
+
+    rec = (uint8_t *)alloc_aligned(reclen);
+    if ((s->flags & NAND_F_VERIFY) && rec != NULL)
+        readback = (uint8_t *)alloc_aligned(reclen);
+    if (rec == NULL || ((s->flags & NAND_F_VERIFY) && readback == NULL)) {
+        nand_msg("malloc %zu size buffer failed!\n", reclen);
+        free(rec);
         fclose(pf);
-        close(fd);
         return -1;
     }
- 
+
     //if offset in a bad block, get next good block
-    blockstart = offset & ~(meminfo.erasesize - 1);
-    if (offset != blockstart) {
-        unsigned int tmp;
-        tmp = next_good_eraseblock(fd, &meminfo, blockstart);
-        if (tmp != blockstart) {
-            offset = tmp;
-        }
-    }
- 
-    while(offset < limit) {
-        blockstart = offset & ~(meminfo.erasesize - 1);
-        if (blockstart == offset) {
-            offset = next_good_eraseblock(fd, &meminfo, blockstart);
-            printf("Writing at 0x%08x\n", offset);
- 
-            if (offset >= limit) {
-                printf("offset(%d) over limit(%d)\n", offset, limit);
-                fclose(pf);
-                close(fd);
-                free(tmp);
-                return -1;
-            }
-        }
- 
-        lseek(fd, offset, SEEK_SET);
- 
-        cnt = fread(tmp, 1, meminfo.writesize, pf);
-        if (cnt == 0) {
-            printf("write ok!\n");
+    blockstart = offset & ~(uint64_t)(meminfo->erasesize - 1);
+    if (offset != blockstart && nand_block_isbad(s, blockstart))
+        offset = next_good_eraseblock(s, blockstart);
+
+    while (1) {
+        cnt = fread(rec, 1, reclen, pf);
+        if (cnt == 0)
+            break;
+        if (cnt != reclen) {
+            nand_msg("%s: %zu trailing bytes, not a whole page + oob\n", file_name, cnt);
+            ret = -1;
             break;
         }
- 
-        if (cnt < meminfo.writesize) {
-            /* zero pad to end of write block */
-            memset(tmp + cnt, 0, meminfo.writesize - cnt);
+
+        if ((offset & (meminfo->erasesize - 1)) == 0 && offset < limit) {
+            offset = next_good_eraseblock(s, offset);
+            nand_msg("Writing at 0x%08llx\n", (unsigned long long)offset);
         }
- 
-        size = write(fd, tmp, meminfo.writesize);
-        if (size != meminfo.writesize) {
-            printf("write err, need :%d, real :%d\n", meminfo.writesize, size );
-            fclose(pf);
-            close(fd);
-            free(tmp);
-            return -1;
+        if (offset >= limit) {
+            nand_msg("offset(%llu) over limit(%llu)\n", (unsigned long long)offset, (unsigned long long)limit);
+            ret = -1;
+            break;
         }
- 
-        offset += meminfo.writesize;
- 
-        if (cnt < meminfo.writesize) {
-            printf("write ok!\n");
+
+        /* the OOB bytes in use follow the main area, all 0xFF leaves the page erased */
+        if (!((s->flags & NAND_F_SKIP_FF) && nand_is_erased(rec, meminfo->writesize + ooblen)) &&
+            program_page_oob(s, rec, rec + meminfo->writesize, ooblen, offset, mode) < 0) {
+            ret = -1;
             break;
         }
+
+        if (readback != NULL) {
+            if (read_page_oob(s, readback, readback + meminfo->writesize, ooblen, offset, mode) < 0) {
+                ret = -1;
+                break;
+            }
+            if (memcmp(readback, rec, meminfo->writesize + ooblen)) {
+                nand_msg("verify: mismatch in page at 0x%08llx\n", (unsigned long long)offset);
+                ret = -1;
+                break;
+            }
+        }
+
+        offset += meminfo->writesize;
     }
- 
-    //free buf
-    free(tmp);
+
+    if (ferror(pf)) {
+        nand_msg("read input failed!\n");
+        ret = -1;
+    }
+
+    free(readback);
+    free(rec);
     fclose(pf);
-    close(fd);
- 
-    return 0;//test
- 
+    if (ret == 0)
+        nand_msg("write ok!\n");
+    return ret;
 }
 
-int nand_write(const char *device_name, void * data, int32_t size, const int mtd_offset) {
- 
-    mtd_info_t meminfo;
-    unsigned int blockstart;
-    unsigned int limit = 0;
-    int cnt = -1;
-    int size_written = 0;
+/* size counts main area bytes and is rounded up to whole pages, <= 0 dumps to the end */
+int nand_session_dump_oob_file(nand_session_t *s, const char *file_name, int64_t size, uint64_t mtd_offset, int mode) {
+
+    mtd_info_t *meminfo = &s->meminfo;
+    uint64_t limit = s->size;
+    uint64_t offset = mtd_offset;
+    uint32_t ooblen = oob_len(s, mode);
+    size_t reclen = meminfo->writesize + meminfo->oobsize;
+    bool to_end = size <= 0;
+    uint32_t pages, done = 0;
+    uint8_t *rec;
     int ret = 0;
-    int offset = mtd_offset;
-  
-    //open mtd device
-    int fd = open(device_name, O_RDWR);
-    if (fd < 0) {
-        printf("open %s failed!\n", device_name);
+    FILE *pf;
+
+    //check offset page aligned
+    if (offset & (meminfo->writesize - 1)) {
+        nand_msg("start address is not page aligned");
         return -1;
     }
- 
-    //get meminfo
-    ret = ioctl(fd, MEMGETINFO, &meminfo);
-    if (ret < 0) {
-        printf("get MEMGETINFO failed!\n");
-        close(fd);
+
+    if (offset >= limit) {
+        nand_msg("offset(%llu) over limit(%llu)\n", (unsigned long long)offset, (unsigned long long)limit);
         return -1;
     }
- 
-    limit = meminfo.size;
-    printf("limit: %d bytes", limit);
- 
-    //check offset page aligned
-    if (offset & (meminfo.writesize - 1)) {
-        printf("start address is not page aligned");
-        close(fd);
+    pages = to_end ? (uint32_t)((limit - offset) / meminfo->writesize) :
+                     (uint32_t)(((uint64_t)size + meminfo->writesize - 1) / meminfo->writesize);
+
+    rec = (uint8_t *)alloc_aligned(reclen);
+    if (rec == NULL) {
+        nand_msg("malloc %zu size buffer failed!\n", reclen);
         return -1;
     }
- 
-    //malloc buffer for read 
-    char *tmp = (char *)malloc(meminfo.writesize);
-    if (tmp == NULL) {
-        printf("malloc %d size buffer failed!\n", meminfo.writesize);
-        close(fd);
+    /* auto placement leaves the tail of each OOB record unused */
+    memset(rec + meminfo->writesize + ooblen, 0xFF, meminfo->oobsize - ooblen);
+
+    pf = fopen(file_name, "w");
+    if (pf == NULL) {
+        nand_msg("fopen %s failed!\n", file_name);
+        free(rec);
         return -1;
     }
- 
-    //if offset in a bad block, get next good block
-    blockstart = offset & ~(meminfo.erasesize - 1);
-    if (offset != blockstart) {
-        unsigned int tmp;
-        tmp = next_good_eraseblock(fd, &meminfo, blockstart);
-        if (tmp != blockstart) {
-            offset = tmp;
-        }
-    }
- 
-    while(offset < limit) {
-        blockstart = offset & ~(meminfo.erasesize - 1);
-        if (blockstart == offset) {
-            offset = next_good_eraseblock(fd, &meminfo, blockstart);
-            printf("Writing at 0x%08x\n", offset);
- 
-            if (offset >= limit) {
-                printf("offset(%d) over limit(%d)\n", offset, limit);
-                close(fd);
-                free(tmp);
-                return -1;
-            }
-        }
- 
-        lseek(fd, offset, SEEK_SET);
 
-        cnt = size < meminfo.writesize? size: meminfo.writesize;
-        memcpy(tmp, data, cnt);
- 
-        if (cnt < meminfo.writesize) {
-            /* zero pad to end of write block */
-            memset(tmp + cnt, 0, meminfo.writesize - cnt);
+    while (done < pages && offset < limit) {
+        if ((offset & (meminfo->erasesize - 1)) == 0) {
+            offset = next_good_eraseblock(s, offset);
+            nand_msg("reading from block at 0x%08llx\n", (unsigned long long)offset);
+
+            if (offset >= limit)
+                break;
         }
- 
-        size_written = write(fd, tmp, meminfo.writesize);
-        if (size_written != meminfo.writesize) {
-            printf("write err, need :%d, real :%d\n", meminfo.writesize, size_written);
-            close(fd);
-            free(tmp);
-            return -1;
+
+        if (read_page_oob(s, rec, rec + meminfo->writesize, ooblen, offset, mode) < 0) {
+            ret = -1;
+            break;
         }
- 
-        offset += meminfo.writesize;
- 
-        if (cnt < meminfo.writesize) {
-            printf("write ok!\n");
+        if (fwrite(rec, 1, reclen, pf) != reclen) {
+            nand_msg("write %s failed!\n", file_name);
+            ret = -1;
             break;
         }
+
+        done++;
+        offset += meminfo->writesize;
     }
- 
-    //free buf
-    free(tmp);
-    close(fd);
- 
-    return 0;//test
- 
+
+    if (ret == 0 && done < pages && !to_end) {
+        nand_msg("offset(%llu) over limit(%llu)\n", (unsigned long long)offset, (unsigned long long)limit);
+        ret = -1;
+    }
+
+    if (fclose(pf) != 0) {
+        nand_msg("close %s failed!\n", file_name);
+        ret = -1;
+    }
+    free(rec);
+
+    if (ret == 0)
+        nand_msg("dump %u pages + oob to %s done!\n", done, file_name);
+    return ret;
 }
 
 
-int nand_dump(const char *device_name, void * buffer, int32_t size, const int mtd_offset){
-    
-    mtd_info_t meminfo;
-    unsigned int blockstart;
-    unsigned int limit = 0;
-    int cnt = -1;
-    int size_read = 0; 
-    int ret = 0;
-    int offset = mtd_offset;
-    int size_copy = 0;
-    uint8_t *local_ptr = (uint8_t *)buffer;
+int nand_erase(const char *device_name, uint64_t offset, uint64_t len) {
 
-    //open mtd device
-    int fd = open(device_name, O_RDWR);
-    if(fd < 0)
-    {        
-        printf("open %s failed!\n", device_name);
-        return -1;
-    }
+    int ret;
+    nand_session_t *s = nand_open(device_name);
 
- 
-    //get meminfo
-    ret = ioctl(fd, MEMGETINFO, &meminfo);
-    if (ret < 0) {
-        printf("get MEMGETINFO failed!\n");
-        close(fd);
+    if (s == NULL)
         return -1;
-    }
+    ret = nand_session_erase(s, offset, len);
+    nand_close(s);
+    return ret;
+}
 
-    limit = meminfo.size;
-    printf("limit: %d bytes", limit);
+int nand_write_file(const char *device_name, const char *file_name, uint64_t mtd_offset) {
 
-    //check offset page aligned
-    if (offset & (meminfo.writesize - 1)) {
-        printf("start address is not page aligned");
-        close(fd);
+    int ret;
+    nand_session_t *s = nand_open(device_name);
+
+    if (s == NULL)
         return -1;
-    }
+    ret = nand_session_write_file(s, file_name, mtd_offset);
+    nand_close(s);
+    return ret;
+}
 
-    //if offset in a bad block, stop read
-    blockstart = offset & ~(meminfo.erasesize - 1);
+int nand_write(const char *device_name, const void * data, size_t size, uint64_t mtd_offset) {
 
-    if(blockstart >= limit)
-    {
-        printf("not enough space in MTD device");
+    int ret;
+    nand_session_t *s = nand_open(device_name);
+
+    if (s == NULL)
         return -1;
-    }
+    ret = nand_session_write(s, data, size, mtd_offset);
+    nand_close(s);
+    return ret;
+}
 
+int nand_dump(const char *device_name, void * buffer, size_t size, uint64_t mtd_offset) {
 
-    /* ioctl returned 1 => "bad block" */
-    if (ioctl(fd, MEMGETBADBLOCK, &blockstart) == -1)
-    {
-        printf("bad block at 0x%08x, dump failed\n", blockstart);
+    int ret;
+    nand_session_t *s = nand_open(device_name);
+
+    if (s == NULL)
         return -1;
-    }
+    ret = nand_session_dump(s, buffer, size, mtd_offset);
+    nand_close(s);
+    return ret;
+}
 
+int nand_dump_file(const char *device_name, const char *file_name, int64_t size, uint64_t mtd_offset) {
 
-    //malloc buffer for read 
-    char *temp_space = (char *)malloc(meminfo.writesize);
-    if (temp_space == NULL) {
-        printf("malloc %d size buffer failed!\n", meminfo.writesize);
-        close(fd);
+    int ret;
+    nand_session_t *s = nand_open(device_name);
+
+    if (s == NULL)
         return -1;
-    }
+    ret = nand_session_dump_file(s, file_name, size, mtd_offset);
+    nand_close(s);
+    return ret;
+}
 
+int nand_erase_write_file(const char *device_name, const char *file_name, uint64_t mtd_offset) {
 
-    /* dump process */
-    while(offset < limit)
-    {
-        blockstart = offset & ~(meminfo.erasesize - 1);
-        if (blockstart == offset) {
-            offset = next_good_eraseblock(fd, &meminfo, blockstart);
-            printf("reading from block at 0x%08x\n", offset);
- 
-            if (offset >= limit) {
-                printf("offset(%d) over limit(%d)\n", offset, limit);
-                close(fd);
-                free(temp_space);
-                return -1;
-            }
-        }
+    int ret;
+    nand_session_t *s = nand_open(device_name);
 
-        lseek(fd, offset, SEEK_SET);
+    if (s == NULL)
+        return -1;
+    ret = nand_session_erase_write_file(s, file_name, mtd_offset);
+    nand_close(s);
+    return ret;
+}
 
-        /* read one page at one time */
-        size_read = read(fd, temp_space, meminfo.writesize);
+int nand_write_oob_file(const char *device_name, const char *file_name, uint64_t mtd_offset, int mode) {
 
-        // if(size_read < 0)
-        // {
-        //     printf("read err, need %d, return %d\n",)
-        // }
+    int ret;
+    nand_session_t *s = nand_open(device_name);
 
+    if (s == NULL)
+        return -1;
+    ret = nand_session_write_oob_file(s, file_name, mtd_offset, mode);
+    nand_close(s);
+    return ret;
+}
 
-        if (size_read != meminfo.writesize) 
-        {
-            printf("read err, need :%d, real :%d\n", meminfo.writesize, size_read);
-            close(fd);
-            free(temp_space);
-            return -1;
-        }
+int nand_dump_oob_file(const char *device_name, const char *file_name, int64_t size, uint64_t mtd_offset, int mode) {
 
-        /* copy read page into the RAM buffer */
-        size_copy = size > meminfo.writesize? meminfo.writesize: size;
-        memcpy(local_ptr, temp_space, size_copy);
-        local_ptr += size_copy;
-        size -= size_copy;
-        
-        if(size <= 0)
-        {
-            printf("read done!\n");
-            break;
-        }
+    int ret;
+    nand_session_t *s = nand_open(device_name);
 
-    }
-    
-    free(temp_space);
-    close(fd);
-    
-    return 0;
-}
\ No newline at end of file
+    if (s == NULL)
+        return -1;
+    ret = nand_session_dump_oob_file(s, file_name, size, mtd_offset, mode);
+    nand_close(s);
+    return ret;
+}
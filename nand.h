@@ -1,8 +1,12 @@
+#ifndef NAND_H
+#define NAND_H
+
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -16,7 +20,136 @@
 #include <asm/types.h>
 #include "mtd/mtd-user.h"
 
-int nand_erase(const char *device_name, const int offset, const int len);
-int nand_write_file(const char *device_name, const char *file_name, const int mtd_offset);
-int nand_dump(const char *device_name, void * buffer, int32_t size, const int mtd_offset);
-int nand_write(const char *device_name, void * data, int32_t size, const int mtd_offset);
\ No newline at end of file
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* device operations used by the I/O engine, swap them to run against a simulator */
+typedef struct nand_dev_ops
+{
+    int     (*open)(const char *device_name, int flags);
+    int     (*close)(int fd);
+    int     (*fstat)(int fd, struct stat *st);
+    int     (*ioctl)(int fd, unsigned long request, void *arg);
+    off_t   (*lseek)(int fd, off_t offset, int whence);
+    ssize_t (*read)(int fd, void *buf, size_t count);
+    ssize_t (*write)(int fd, const void *buf, size_t count);
+    ssize_t (*pread)(int fd, void *buf, size_t count, off_t offset);
+    ssize_t (*pwrite)(int fd, const void *buf, size_t count, off_t offset);
+}nand_dev_ops_t;
+
+/* real /dev/mtdX character device, the default */
+extern const nand_dev_ops_t nand_mtd_ops;
+
+void nand_set_dev_ops(const nand_dev_ops_t *ops);
+const nand_dev_ops_t *nand_get_dev_ops(void);
+
+/* session flags */
+#define NAND_F_BATCH        (1u << 0)   /* write_file programs a whole eraseblock per pwrite */
+#define NAND_F_SKIP_BLANK   (1u << 1)   /* erase skips blocks that already read back all 0xFF */
+#define NAND_F_SKIP_FF      (1u << 2)   /* writes pad with 0xFF and don't program all 0xFF pages */
+#define NAND_F_PIPELINE     (1u << 3)   /* write_file reads input on a thread while programming */
+#define NAND_F_VERIFY       (1u << 4)   /* read back and compare every block right after programming it */
+#define NAND_F_DELTA        (1u << 5)   /* erase_write_file only erases and programs blocks that differ */
+#define NAND_F_DUMP_HOLES   (1u << 6)   /* dump_file leaves erased pages as file holes */
+#define NAND_F_DUMP_SPARSE  (1u << 7)   /* dump_file writes an Android sparse image */
+
+/* flags new sessions start with */
+void nand_set_flags(unsigned int flags);
+
+/* library messages go to stdout, off for in-process users that only look at return codes */
+void nand_set_verbose(bool on);
+void nand_msg(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+/* on-disk copy of the bad block table used by nand_open, NULL to always scan */
+void nand_set_bbt_cache(const char *path);
+
+/* Android sparse image, taken by write_file instead of a plain image, little endian */
+#define NAND_SPARSE_MAGIC       0xED26FF3A
+#define NAND_SPARSE_RAW         0xCAC1      /* chunk_sz blocks of data follow */
+#define NAND_SPARSE_FILL        0xCAC2      /* a 4 byte pattern follows */
+#define NAND_SPARSE_DONT_CARE   0xCAC3      /* nothing follows, flash is left as it is */
+#define NAND_SPARSE_CRC32       0xCAC4      /* a crc32 of the data so far follows */
+
+typedef struct nand_sparse_header
+{
+    uint32_t    magic;
+    uint16_t    major_version;              /* 1 */
+    uint16_t    minor_version;
+    uint16_t    file_hdr_sz;                /* bytes of this header in the file */
+    uint16_t    chunk_hdr_sz;               /* bytes of every chunk header in the file */
+    uint32_t    blk_sz;                     /* chunk sizes count blocks of this many bytes */
+    uint32_t    total_blks;                 /* blocks in the unpacked image */
+    uint32_t    total_chunks;
+    uint32_t    image_checksum;
+}nand_sparse_header_t;
+
+typedef struct nand_sparse_chunk
+{
+    uint16_t    chunk_type;                 /* NAND_SPARSE_* */
+    uint16_t    reserved1;
+    uint32_t    chunk_sz;                   /* blocks of the unpacked image */
+    uint32_t    total_sz;                   /* bytes in the file, header included */
+}nand_sparse_chunk_t;
+
+/* open device, keeps the fd, geometry and a scratch page for the whole session */
+typedef struct nand_session
+{
+    int                     fd;
+    const nand_dev_ops_t    *ops;           /* ops the session was opened with */
+    mtd_info_t              meminfo;
+    uint64_t                size;           /* device size, meminfo.size is only 32 bit */
+    unsigned int            flags;          /* NAND_F_* */
+    uint8_t                 *page_buf;      /* writesize bytes, memory page aligned */
+    uint8_t                 *block_buf;     /* erasesize bytes, allocated on first batched use */
+    uint8_t                 *verify_buf;    /* erasesize bytes, readback for NAND_F_VERIFY */
+    uint32_t                *bbt;           /* bad block bitmap, 1 bit per eraseblock, NULL until first used */
+    uint32_t                *bbt_filled;    /* 1 bit per bbt word, set once its 32 blocks were queried */
+    uint32_t                nblocks;
+}nand_session_t;
+
+nand_session_t *nand_open(const char *device_name);
+void nand_close(nand_session_t *s);
+
+/*
+ * bad block table, filled per 32 blocks by the lookups that need it. scan
+ * builds all of it in one MEMGETBADBLOCK pass, load takes it from a cache file
+ */
+int nand_bbt_scan(nand_session_t *s);
+int nand_bbt_load(nand_session_t *s, const char *path);
+int nand_bbt_save(nand_session_t *s, const char *path);
+int nand_block_isbad(nand_session_t *s, uint64_t offset);
+/* erase the eraseblock at offset, MEMERASE64 so it works past 4GiB */
+int nand_block_erase(nand_session_t *s, uint64_t offset);
+
+/* true if the buffer reads like an erased page, every byte 0xFF */
+bool nand_is_erased(const void *buf, size_t len);
+
+int nand_session_erase(nand_session_t *s, uint64_t offset, uint64_t len);
+int nand_session_write_file(nand_session_t *s, const char *file_name, uint64_t mtd_offset);
+int nand_session_erase_write_file(nand_session_t *s, const char *file_name, uint64_t mtd_offset);
+int nand_session_dump(nand_session_t *s, void * buffer, size_t size, uint64_t mtd_offset);
+int nand_session_dump_file(nand_session_t *s, const char *file_name, int64_t size, uint64_t mtd_offset);
+int nand_session_write(nand_session_t *s, const void * data, size_t size, uint64_t mtd_offset);
+/* page + oob images (nanddump -o layout), one MEMWRITE/MEMREAD per page, mode is MTD_OPS_* */
+int nand_session_write_oob_file(nand_session_t *s, const char *file_name, uint64_t mtd_offset, int mode);
+int nand_session_dump_oob_file(nand_session_t *s, const char *file_name, int64_t size, uint64_t mtd_offset, int mode);
+
+/* one shot versions, open and close the device around a single operation */
+int nand_erase(const char *device_name, uint64_t offset, uint64_t len);
+/* plain image or Android sparse image, told apart by the magic */
+int nand_write_file(const char *device_name, const char *file_name, uint64_t mtd_offset);
+/* erase the blocks the image lands in while writing it, offset eraseblock aligned, honours NAND_F_DELTA */
+int nand_erase_write_file(const char *device_name, const char *file_name, uint64_t mtd_offset);
+int nand_dump(const char *device_name, void * buffer, size_t size, uint64_t mtd_offset);
+int nand_write(const char *device_name, const void * data, size_t size, uint64_t mtd_offset);
+/* size <= 0 dumps up to the end of the device, honours NAND_F_DUMP_HOLES and NAND_F_DUMP_SPARSE */
+int nand_dump_file(const char *device_name, const char *file_name, int64_t size, uint64_t mtd_offset);
+int nand_write_oob_file(const char *device_name, const char *file_name, uint64_t mtd_offset, int mode);
+int nand_dump_oob_file(const char *device_name, const char *file_name, int64_t size, uint64_t mtd_offset, int mode);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,306 @@
+#include <limits.h>
+#include <getopt.h>
+#include "nand.h"
+#include "nand_sim.h"
+#include "nand_log.h"
+
+/*
+ * Throughput and latency benchmark over the file-backed simulator.
+ *
+ * For every page/eraseblock size, bad block density and image size of the
+ * matrix the device is erased, the image written with the page loop, the
+ * batched and the pipelined write_file, dumped back, and the preserved data
+ * update (log read + append + reclaim) is run many times. Each operation
+ * goes through the one shot API the tools use, so the device open and bad
+ * block scan are part of the numbers. Results are the p50/p99 over the runs.
+ */
+
+#define BENCH_DEV_SIZE      (64 * 1024 * 1024)
+#define BENCH_LOG_BLOCKS    4                   /* same log region as the nand tool */
+
+struct bench_geometry
+{
+    uint32_t    writesize;
+    uint32_t    erasesize;
+};
+
+static const struct bench_geometry geometries[] = {
+    { 2048, 128 * 1024 },
+    { 4096, 256 * 1024 },
+};
+static const unsigned int bad_percents[] = { 0, 2 };
+static const uint32_t image_sizes[] = { 1024 * 1024, 8 * 1024 * 1024 };
+
+/* Options */
+static unsigned int reps = 5;               /* runs of every erase/write/dump */
+static unsigned int updates = 50;           /* runs of the update */
+static const char *dir = "/tmp";            /* where the backing and image files go */
+static bool timing = false;                 /* model typical SLC chip latencies */
+
+
+typedef struct _GENSAT_1_cFS_preserved_data_
+{
+    int16_t     deploy_state;
+    int16_t     num_launch_state;
+    uint16_t    crc_check;
+    int16_t     spare;
+}GENSAT_1_cFS_preserved_data;
+
+
+static double now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* nearest rank percentile, sorts the samples */
+static double percentile(double *samples, unsigned int n, unsigned int p)
+{
+    unsigned int rank = (p * n + 99) / 100;
+
+    qsort(samples, n, sizeof(double), cmp_double);
+    return samples[rank ? rank - 1 : 0];
+}
+
+static void report(const char *op, const struct bench_geometry *g, unsigned int bad,
+                   uint32_t image, uint32_t bytes, double *samples, unsigned int n, unsigned int failed)
+{
+    double p50 = percentile(samples, n, 50);
+    double p99 = percentile(samples, n, 99);
+    char image_kib[16] = "-";
+
+    if (image)
+        snprintf(image_kib, sizeof(image_kib), "%u", image / 1024);
+    printf("%-12s %5u %6u %4u %9s %5u %9.3f %9.3f %9.2f%s\n", op, g->writesize, g->erasesize / 1024,
+            bad, image_kib, n, p50, p99, bytes && p50 > 0 ? bytes / (p50 / 1e3) / 1e6 : 0.0,
+            failed ? "  FAILED" : "");
+    fflush(stdout);
+}
+
+static int make_image(const char *path, uint32_t size)
+{
+    FILE *pf = fopen(path, "w");
+    uint32_t i;
+
+    if (pf == NULL)
+        return -1;
+    /* incompressible and no all 0xFF pages */
+    for (i = 0; i < size; i++)
+        fputc(rand() & 0x7F, pf);
+    return fclose(pf);
+}
+
+static void configure(const struct bench_geometry *g, unsigned int bad, const char *dev)
+{
+    nand_sim_config_t cfg;
+    uint32_t nblocks = BENCH_DEV_SIZE / g->erasesize;
+    uint32_t *bad_blocks = NULL;
+    uint32_t i;
+    char oob[PATH_MAX + 5];
+
+    nand_sim_default_config(&cfg);
+    cfg.size = BENCH_DEV_SIZE;
+    cfg.writesize = g->writesize;
+    cfg.erasesize = g->erasesize;
+    cfg.oobsize = g->writesize / 32;
+    if (timing) {
+        cfg.read_page_us = 25;
+        cfg.program_page_us = 250;
+        cfg.erase_block_us = 2000;
+    }
+
+    /* spread over the device, the log region stays good */
+    cfg.num_bad_blocks = nblocks * bad / 100;
+    if (cfg.num_bad_blocks) {
+        bad_blocks = (uint32_t *)malloc(cfg.num_bad_blocks * sizeof(uint32_t));
+        for (i = 0; bad_blocks != NULL && i < cfg.num_bad_blocks; i++)
+            bad_blocks[i] = BENCH_LOG_BLOCKS + rand() % (nblocks - BENCH_LOG_BLOCKS);
+        if (bad_blocks == NULL)
+            cfg.num_bad_blocks = 0;
+    }
+    cfg.bad_blocks = bad_blocks;
+    nand_sim_set_config(&cfg);
+    free(bad_blocks);
+
+    /* fresh backing file with the new geometry */
+    snprintf(oob, sizeof(oob), "%s.oob", dev);
+    unlink(dev);
+    unlink(oob);
+}
+
+static int update_once(const char *dev)
+{
+    GENSAT_1_cFS_preserved_data data;
+    nand_log_t log;
+    nand_session_t *s = nand_open(dev);
+    int ret = -1;
+
+    if (s == NULL)
+        return -1;
+    memset(&data, 0, sizeof(data));     /* first update finds no record */
+    if (nand_log_open(&log, s, 0, BENCH_LOG_BLOCKS) == 0 && nand_log_read(&log, &data, sizeof(data)) >= 0) {
+        data.num_launch_state++;
+        if (nand_log_append(&log, &data, sizeof(data)) == 0 && nand_log_reclaim(&log) == 0)
+            ret = 0;
+    }
+    nand_close(s);
+    return ret;
+}
+
+static void bench_config(const struct bench_geometry *g, unsigned int bad, uint32_t image,
+                         const char *dev, const char *image_path)
+{
+    static const struct { const char *name; unsigned int flags; } modes[] = {
+        { "write",          0 },
+        { "write-batch",    NAND_F_BATCH },
+        { "write-pipe",     NAND_F_PIPELINE },
+    };
+    unsigned int nmodes = sizeof(modes) / sizeof(modes[0]);
+    double *erase_ms = (double *)calloc(reps * nmodes, sizeof(double));
+    double *write_ms = (double *)calloc(reps * nmodes, sizeof(double));
+    double *dump_ms = (double *)calloc(reps, sizeof(double));
+    uint8_t *buf = (uint8_t *)malloc(image);
+    unsigned int erase_failed = 0, write_failed[3] = { 0 }, dump_failed = 0;
+    unsigned int r, m;
+    double t;
+
+    if (erase_ms == NULL || write_ms == NULL || dump_ms == NULL || buf == NULL) {
+        printf("out of memory\n");
+        goto out;
+    }
+
+    configure(g, bad, dev);
+
+    for (r = 0; r < reps; r++) {
+        for (m = 0; m < nmodes; m++) {
+            nand_set_flags(0);
+            t = now_ms();
+            erase_failed += nand_erase(dev, 0, BENCH_DEV_SIZE) < 0;
+            erase_ms[r * nmodes + m] = now_ms() - t;
+
+            nand_set_flags(modes[m].flags);
+            t = now_ms();
+            write_failed[m] += nand_write_file(dev, image_path, 0) < 0;
+            write_ms[m * reps + r] = now_ms() - t;
+        }
+
+        nand_set_flags(0);
+        t = now_ms();
+        dump_failed += nand_dump(dev, buf, image, 0) < 0;
+        dump_ms[r] = now_ms() - t;
+    }
+
+    report("erase", g, bad, 0, BENCH_DEV_SIZE, erase_ms, reps * nmodes, erase_failed);
+    for (m = 0; m < nmodes; m++)
+        report(modes[m].name, g, bad, image, image, write_ms + m * reps, reps, write_failed[m]);
+    report("dump", g, bad, image, image, dump_ms, reps, dump_failed);
+
+out:
+    free(erase_ms);
+    free(write_ms);
+    free(dump_ms);
+    free(buf);
+}
+
+/* update latency does not depend on the image, once per geometry and density */
+static void bench_update(const struct bench_geometry *g, unsigned int bad, const char *dev)
+{
+    double *ms = (double *)calloc(updates, sizeof(double));
+    unsigned int failed = 0, u;
+    double t;
+
+    if (ms == NULL || updates == 0) {
+        free(ms);
+        return;
+    }
+
+    configure(g, bad, dev);
+    nand_set_flags(0);
+    nand_erase(dev, 0, BENCH_LOG_BLOCKS * g->erasesize);
+
+    for (u = 0; u < updates; u++) {
+        t = now_ms();
+        failed += update_once(dev) < 0;
+        ms[u] = now_ms() - t;
+    }
+    report("update", g, bad, 0, 0, ms, updates, failed);
+    free(ms);
+}
+
+static void process_options(int argc, char *argv[])
+{
+    int c;
+
+    while ((c = getopt(argc, argv, "r:u:d:t")) != -1) {
+        switch (c) {
+        case 'r':
+            reps = (unsigned int)strtoul(optarg, NULL, 0);
+            break;
+        case 'u':
+            updates = (unsigned int)strtoul(optarg, NULL, 0);
+            break;
+        case 'd':
+            dir = optarg;
+            break;
+        case 't':
+            timing = true;
+            break;
+        default:
+            fprintf(stderr, "Usage: nand_bench [-r reps] [-u updates] [-d dir] [-t]\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (reps == 0)
+        reps = 1;
+}
+
+int main(int argc, char *argv[])
+{
+    char dev[PATH_MAX], image_path[PATH_MAX], oob[PATH_MAX + 5];
+    unsigned int g, b, i;
+
+    process_options(argc, argv);
+    snprintf(dev, sizeof(dev), "%s/nand_bench_%d.sim", dir, (int)getpid());
+    snprintf(oob, sizeof(oob), "%s.oob", dev);
+
+    /* keep the library's progress lines out of the table */
+    nand_set_verbose(false);
+
+    srand(1);
+    nand_set_dev_ops(&nand_sim_ops);
+
+    printf("# %u MiB simulated device, %s, %u runs, %u updates, times in ms\n",
+            BENCH_DEV_SIZE >> 20, timing ? "typical SLC timing" : "no chip latency", reps, updates);
+    printf("%-12s %5s %6s %4s %9s %5s %9s %9s %9s\n",
+            "op", "page", "blkKiB", "bad%", "imageKiB", "runs", "p50", "p99", "MB/s@p50");
+
+    for (i = 0; i < sizeof(image_sizes) / sizeof(image_sizes[0]); i++) {
+        snprintf(image_path, sizeof(image_path), "%s/nand_bench_%d_%u.img", dir, (int)getpid(), i);
+        if (make_image(image_path, image_sizes[i]) < 0) {
+            printf("create %s failed!\n", image_path);
+            return EXIT_FAILURE;
+        }
+
+        for (g = 0; g < sizeof(geometries) / sizeof(geometries[0]); g++)
+            for (b = 0; b < sizeof(bad_percents) / sizeof(bad_percents[0]); b++)
+                bench_config(&geometries[g], bad_percents[b], image_sizes[i], dev, image_path);
+        unlink(image_path);
+    }
+
+    for (g = 0; g < sizeof(geometries) / sizeof(geometries[0]); g++)
+        for (b = 0; b < sizeof(bad_percents) / sizeof(bad_percents[0]); b++)
+            bench_update(&geometries[g], bad_percents[b], dev);
+
+    unlink(dev);
+    unlink(oob);
+    return 0;
+}
@@ -0,0 +1,297 @@
+#include <stdbool.h>
+#include <string.h>
+#include "nand_crc.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define NAND_CRC_CLMUL_X86
+#endif
+
+#if defined(__aarch64__) || (defined(__ARM_FEATURE_CRYPTO) && defined(__ARM_NEON))
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#define NAND_CRC_PMULL_ARM
+#ifdef __aarch64__
+#define NAND_CRC_PMULL_TARGET   __attribute__((target("+crypto")))
+#else
+#define NAND_CRC_PMULL_TARGET
+#endif
+#endif
+
+/*
+ * CRC-16 with the reflected polynomial 0xA001 (x^16 + x^15 + x^2 + 1), no
+ * final xor. Three kernels give the same result: byte at a time on CrcTable,
+ * slice-by-8 on tables derived from it, and carry-less multiply folding of
+ * 64 bytes per step on cpus with PCLMULQDQ or PMULL. The fastest one the cpu
+ * supports is picked once at startup.
+ */
+
+static const uint16_t CrcTable[256]=
+    {
+
+		    0x0000, 0xC0C1, 0xC181, 0x0140, 0xC301, 0x03C0, 0x0280, 0xC241,
+		    0xC601, 0x06C0, 0x0780, 0xC741, 0x0500, 0xC5C1, 0xC481, 0x0440,
+		    0xCC01, 0x0CC0, 0x0D80, 0xCD41, 0x0F00, 0xCFC1, 0xCE81, 0x0E40,
+		    0x0A00, 0xCAC1, 0xCB81, 0x0B40, 0xC901, 0x09C0, 0x0880, 0xC841,
+		    0xD801, 0x18C0, 0x1980, 0xD941, 0x1B00, 0xDBC1, 0xDA81, 0x1A40,
+		    0x1E00, 0xDEC1, 0xDF81, 0x1F40, 0xDD01, 0x1DC0, 0x1C80, 0xDC41,
+		    0x1400, 0xD4C1, 0xD581, 0x1540, 0xD701, 0x17C0, 0x1680, 0xD641,
+		    0xD201, 0x12C0, 0x1380, 0xD341, 0x1100, 0xD1C1, 0xD081, 0x1040,
+		    0xF001, 0x30C0, 0x3180, 0xF141, 0x3300, 0xF3C1, 0xF281, 0x3240,
+		    0x3600, 0xF6C1, 0xF781, 0x3740, 0xF501, 0x35C0, 0x3480, 0xF441,
+		    0x3C00, 0xFCC1, 0xFD81, 0x3D40, 0xFF01, 0x3FC0, 0x3E80, 0xFE41,
+		    0xFA01, 0x3AC0, 0x3B80, 0xFB41, 0x3900, 0xF9C1, 0xF881, 0x3840,
+		    0x2800, 0xE8C1, 0xE981, 0x2940, 0xEB01, 0x2BC0, 0x2A80, 0xEA41,
+		    0xEE01, 0x2EC0, 0x2F80, 0xEF41, 0x2D00, 0xEDC1, 0xEC81, 0x2C40,
+		    0xE401, 0x24C0, 0x2580, 0xE541, 0x2700, 0xE7C1, 0xE681, 0x2640,
+		    0x2200, 0xE2C1, 0xE381, 0x2340, 0xE101, 0x21C0, 0x2080, 0xE041,
+		    0xA001, 0x60C0, 0x6180, 0xA141, 0x6300, 0xA3C1, 0xA281, 0x6240,
+		    0x6600, 0xA6C1, 0xA781, 0x6740, 0xA501, 0x65C0, 0x6480, 0xA441,
+		    0x6C00, 0xACC1, 0xAD81, 0x6D40, 0xAF01, 0x6FC0, 0x6E80, 0xAE41,
+		    0xAA01, 0x6AC0, 0x6B80, 0xAB41, 0x6900, 0xA9C1, 0xA881, 0x6840,
+		    0x7800, 0xB8C1, 0xB981, 0x7940, 0xBB01, 0x7BC0, 0x7A80, 0xBA41,
+		    0xBE01, 0x7EC0, 0x7F80, 0xBF41, 0x7D00, 0xBDC1, 0xBC81, 0x7C40,
+		    0xB401, 0x74C0, 0x7580, 0xB541, 0x7700, 0xB7C1, 0xB681, 0x7640,
+		    0x7200, 0xB2C1, 0xB381, 0x7340, 0xB101, 0x71C0, 0x7080, 0xB041,
+		    0x5000, 0x90C1, 0x9181, 0x5140, 0x9301, 0x53C0, 0x5280, 0x9241,
+		    0x9601, 0x56C0, 0x5780, 0x9741, 0x5500, 0x95C1, 0x9481, 0x5440,
+		    0x9C01, 0x5CC0, 0x5D80, 0x9D41, 0x5F00, 0x9FC1, 0x9E81, 0x5E40,
+		    0x5A00, 0x9AC1, 0x9B81, 0x5B40, 0x9901, 0x59C0, 0x5880, 0x9841,
+		    0x8801, 0x48C0, 0x4980, 0x8941, 0x4B00, 0x8BC1, 0x8A81, 0x4A40,
+		    0x4E00, 0x8EC1, 0x8F81, 0x4F40, 0x8D01, 0x4DC0, 0x4C80, 0x8C41,
+		    0x4400, 0x84C1, 0x8581, 0x4540, 0x8701, 0x47C0, 0x4680, 0x8641,
+		    0x8201, 0x42C0, 0x4380, 0x8341, 0x4100, 0x81C1, 0x8081, 0x4040
+
+};
+
+/* CrcSlice[k][b]: crc of byte b followed by k zero bytes */
+static uint16_t CrcSlice[8][256];
+
+typedef uint16_t (*crc16_kernel_t)(const uint8_t *buf, size_t len, uint16_t crc);
+
+static crc16_kernel_t crc16_kernel;
+static const char *crc16_kernel_name;
+
+static uint16_t crc16_bytewise(const uint8_t *buf, size_t len, uint16_t crc)
+{
+    /*
+    * It is assumed that the supplied buffer is in a
+    * directly-accessible memory space that does not
+    * require special logic to access
+    */
+    while (len--)
+        crc = (crc >> 8) ^ CrcTable[(crc ^ *buf++) & 0xFF];
+    return crc;
+}
+
+static uint16_t crc16_slice8(const uint8_t *buf, size_t len, uint16_t crc)
+{
+    while (len >= 8) {
+        uint16_t x = crc ^ (buf[0] | (buf[1] << 8));
+
+        crc = CrcSlice[7][x & 0xFF] ^ CrcSlice[6][x >> 8] ^
+              CrcSlice[5][buf[2]] ^ CrcSlice[4][buf[3]] ^
+              CrcSlice[3][buf[4]] ^ CrcSlice[2][buf[5]] ^
+              CrcSlice[1][buf[6]] ^ CrcSlice[0][buf[7]];
+        buf += 8;
+        len -= 8;
+    }
+    return crc16_bytewise(buf, len, crc);
+}
+
+/*
+ * Folding constants. A 16 byte little endian load puts the first message bit
+ * in bit 0, so a block is the bit reflected polynomial and a carry-less
+ * product of two reflected 64 bit halves comes out one bit short. Using
+ * x^(n-1) mod P instead of x^n mod P makes up for it. Each constant is a
+ * degree < 16 remainder reflected into the top of a 64 bit word.
+ */
+static uint64_t fold512_lo, fold512_hi;     /* advance a block by 4 blocks */
+static uint64_t fold128_lo, fold128_hi;     /* advance a block by 1 block */
+
+static uint64_t xpow_mod_reflected(unsigned int n)
+{
+    uint32_t r = 1;
+    uint64_t k = 0;
+    unsigned int i;
+
+    for (i = 0; i < n; i++) {
+        r <<= 1;
+        if (r & 0x10000)
+            r ^= 0x18005;
+    }
+    for (i = 0; i < 16; i++) {
+        if (r & (1u << i))
+            k |= 1ull << (63 - i);
+    }
+    return k;
+}
+
+#if defined(NAND_CRC_CLMUL_X86) || defined(NAND_CRC_PMULL_ARM)
+/* crc of what the 16 folded bytes stand for, then the bytes left over */
+static uint16_t crc16_fold_finish(const uint8_t folded[16], const uint8_t *buf, size_t len)
+{
+    return crc16_slice8(buf, len, crc16_slice8(folded, 16, 0));
+}
+#endif
+
+#ifdef NAND_CRC_CLMUL_X86
+__attribute__((target("pclmul,sse2")))
+static __m128i fold_x86(__m128i acc, __m128i k, __m128i next)
+{
+    __m128i lo = _mm_clmulepi64_si128(acc, k, 0x00);
+    __m128i hi = _mm_clmulepi64_si128(acc, k, 0x11);
+
+    return _mm_xor_si128(_mm_xor_si128(lo, hi), next);
+}
+
+__attribute__((target("pclmul,sse2")))
+static uint16_t crc16_clmul_x86(const uint8_t *buf, size_t len, uint16_t crc)
+{
+    __m128i x0, x1, x2, x3, k;
+    uint8_t folded[16];
+
+    if (len < 64)
+        return crc16_slice8(buf, len, crc);
+
+    /* the initial crc goes into the first two message bytes */
+    x0 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)buf), _mm_cvtsi32_si128(crc));
+    x1 = _mm_loadu_si128((const __m128i *)(buf + 16));
+    x2 = _mm_loadu_si128((const __m128i *)(buf + 32));
+    x3 = _mm_loadu_si128((const __m128i *)(buf + 48));
+    buf += 64;
+    len -= 64;
+
+    k = _mm_set_epi64x(fold512_hi, fold512_lo);
+    while (len >= 64) {
+        x0 = fold_x86(x0, k, _mm_loadu_si128((const __m128i *)buf));
+        x1 = fold_x86(x1, k, _mm_loadu_si128((const __m128i *)(buf + 16)));
+        x2 = fold_x86(x2, k, _mm_loadu_si128((const __m128i *)(buf + 32)));
+        x3 = fold_x86(x3, k, _mm_loadu_si128((const __m128i *)(buf + 48)));
+        buf += 64;
+        len -= 64;
+    }
+
+    k = _mm_set_epi64x(fold128_hi, fold128_lo);
+    x1 = fold_x86(x0, k, x1);
+    x2 = fold_x86(x1, k, x2);
+    x3 = fold_x86(x2, k, x3);
+    while (len >= 16) {
+        x3 = fold_x86(x3, k, _mm_loadu_si128((const __m128i *)buf));
+        buf += 16;
+        len -= 16;
+    }
+
+    _mm_storeu_si128((__m128i *)folded, x3);
+    return crc16_fold_finish(folded, buf, len);
+}
+#endif
+
+#ifdef NAND_CRC_PMULL_ARM
+NAND_CRC_PMULL_TARGET
+static uint64x2_t fold_arm(uint64x2_t acc, poly64_t k_lo, poly64_t k_hi, uint64x2_t next)
+{
+    uint64x2_t lo = vreinterpretq_u64_p128(vmull_p64((poly64_t)vgetq_lane_u64(acc, 0), k_lo));
+    uint64x2_t hi = vreinterpretq_u64_p128(vmull_p64((poly64_t)vgetq_lane_u64(acc, 1), k_hi));
+
+    return veorq_u64(veorq_u64(lo, hi), next);
+}
+
+NAND_CRC_PMULL_TARGET
+static uint16_t crc16_pmull_arm(const uint8_t *buf, size_t len, uint16_t crc)
+{
+    uint64x2_t x0, x1, x2, x3;
+    uint8_t folded[16];
+
+    if (len < 64)
+        return crc16_slice8(buf, len, crc);
+
+    /* the initial crc goes into the first two message bytes */
+    x0 = veorq_u64(vreinterpretq_u64_u8(vld1q_u8(buf)), vsetq_lane_u64(crc, vdupq_n_u64(0), 0));
+    x1 = vreinterpretq_u64_u8(vld1q_u8(buf + 16));
+    x2 = vreinterpretq_u64_u8(vld1q_u8(buf + 32));
+    x3 = vreinterpretq_u64_u8(vld1q_u8(buf + 48));
+    buf += 64;
+    len -= 64;
+
+    while (len >= 64) {
+        x0 = fold_arm(x0, fold512_lo, fold512_hi, vreinterpretq_u64_u8(vld1q_u8(buf)));
+        x1 = fold_arm(x1, fold512_lo, fold512_hi, vreinterpretq_u64_u8(vld1q_u8(buf + 16)));
+        x2 = fold_arm(x2, fold512_lo, fold512_hi, vreinterpretq_u64_u8(vld1q_u8(buf + 32)));
+        x3 = fold_arm(x3, fold512_lo, fold512_hi, vreinterpretq_u64_u8(vld1q_u8(buf + 48)));
+        buf += 64;
+        len -= 64;
+    }
+
+    x1 = fold_arm(x0, fold128_lo, fold128_hi, x1);
+    x2 = fold_arm(x1, fold128_lo, fold128_hi, x2);
+    x3 = fold_arm(x2, fold128_lo, fold128_hi, x3);
+    while (len >= 16) {
+        x3 = fold_arm(x3, fold128_lo, fold128_hi, vreinterpretq_u64_u8(vld1q_u8(buf)));
+        buf += 16;
+        len -= 16;
+    }
+
+    vst1q_u8(folded, vreinterpretq_u8_u64(x3));
+    return crc16_fold_finish(folded, buf, len);
+}
+
+static bool cpu_has_pmull(void)
+{
+#ifdef __aarch64__
+    return (getauxval(AT_HWCAP) & HWCAP_PMULL) != 0;
+#else
+    return (getauxval(AT_HWCAP2) & HWCAP2_PMULL) != 0;
+#endif
+}
+#endif
+
+/* runs before main, so the tables are read only once threads exist */
+__attribute__((constructor))
+static void nand_crc16_init(void)
+{
+    unsigned int i, k;
+
+    for (i = 0; i < 256; i++) {
+        CrcSlice[0][i] = CrcTable[i];
+        for (k = 1; k < 8; k++)
+            CrcSlice[k][i] = (CrcSlice[k - 1][i] >> 8) ^ CrcTable[CrcSlice[k - 1][i] & 0xFF];
+    }
+
+    /* the low half of a block sits 64 bits further from the end than the high half */
+    fold512_lo = xpow_mod_reflected(512 + 64 - 1);
+    fold512_hi = xpow_mod_reflected(512 - 1);
+    fold128_lo = xpow_mod_reflected(128 + 64 - 1);
+    fold128_hi = xpow_mod_reflected(128 - 1);
+
+    crc16_kernel = crc16_slice8;
+    crc16_kernel_name = "slice-by-8";
+#ifdef NAND_CRC_CLMUL_X86
+    if (__builtin_cpu_supports("pclmul")) {
+        crc16_kernel = crc16_clmul_x86;
+        crc16_kernel_name = "pclmulqdq";
+    }
+#endif
+#ifdef NAND_CRC_PMULL_ARM
+    if (cpu_has_pmull()) {
+        crc16_kernel = crc16_pmull_arm;
+        crc16_kernel_name = "pmull";
+    }
+#endif
+}
+
+uint16_t nand_crc16(const void *DataPtr, size_t DataLength, uint16_t InputCRC)
+{
+    return crc16_kernel((const uint8_t *)DataPtr, DataLength, InputCRC);
+}
+
+uint16_t nand_crc16_ref(const void *DataPtr, size_t DataLength, uint16_t InputCRC)
+{
+    return crc16_bytewise((const uint8_t *)DataPtr, DataLength, InputCRC);
+}
+
+const char *nand_crc16_kernel(void)
+{
+    return crc16_kernel_name;
+}
@@ -0,0 +1,22 @@
+#ifndef NAND_CRC_H
+#define NAND_CRC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* CRC-16 (poly 0xA001, reflected) used by the preserved data and the record log */
+uint16_t nand_crc16(const void *DataPtr, size_t DataLength, uint16_t InputCRC);
+/* byte at a time reference, same result as nand_crc16 */
+uint16_t nand_crc16_ref(const void *DataPtr, size_t DataLength, uint16_t InputCRC);
+/* name of the kernel nand_crc16 runs on this cpu */
+const char *nand_crc16_kernel(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
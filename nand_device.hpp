@@ -0,0 +1,140 @@
+#ifndef NAND_DEVICE_HPP
+#define NAND_DEVICE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <utility>
+#include "nand.h"
+#include "nand_log.h"
+
+/*
+ * Header-only C++ wrapper of libnand for in-process users, build with
+ * -std=c++20 and link with -lnand -pthread.
+ *
+ * NandDevice owns one session (fd, geometry, scratch page, bad block table)
+ * and is move-only. Reads and writes go straight between the caller's span
+ * and the flash, only a trailing partial page is staged in the session's
+ * scratch page, so nothing is allocated per call. Calls return the codes of
+ * the C API: 0 (or a length) on success, -1 on error or when no device is
+ * open. nand_set_verbose(false) keeps the library from printing.
+ */
+
+namespace nand {
+
+class NandDevice
+{
+public:
+    NandDevice() noexcept = default;
+    explicit NandDevice(const char *device_name) noexcept : s_(nand_open(device_name)) {}
+    ~NandDevice() { nand_close(s_); }
+
+    NandDevice(const NandDevice &) = delete;
+    NandDevice &operator=(const NandDevice &) = delete;
+
+    NandDevice(NandDevice &&other) noexcept : s_(std::exchange(other.s_, nullptr)) {}
+    NandDevice &operator=(NandDevice &&other) noexcept
+    {
+        if (this != &other) {
+            nand_close(s_);
+            s_ = std::exchange(other.s_, nullptr);
+        }
+        return *this;
+    }
+
+    /* closes the session already open, if any */
+    int open(const char *device_name) noexcept
+    {
+        close();
+        s_ = nand_open(device_name);
+        return s_ != nullptr ? 0 : -1;
+    }
+
+    void close() noexcept
+    {
+        nand_close(s_);
+        s_ = nullptr;
+    }
+
+    bool is_open() const noexcept { return s_ != nullptr; }
+    explicit operator bool() const noexcept { return is_open(); }
+
+    /* geometry, only valid while open */
+    uint64_t size() const noexcept { return s_->size; }
+    uint32_t erasesize() const noexcept { return s_->meminfo.erasesize; }
+    uint32_t writesize() const noexcept { return s_->meminfo.writesize; }
+    uint32_t oobsize() const noexcept { return s_->meminfo.oobsize; }
+
+    /* NAND_F_* of this session, e.g. NAND_F_VERIFY or NAND_F_SKIP_FF */
+    void set_flags(unsigned int flags) noexcept { s_->flags = flags; }
+    unsigned int flags() const noexcept { return s_->flags; }
+
+    /* the C session, for the calls this class does not wrap */
+    nand_session_t *session() const noexcept { return s_; }
+
+    /* offsets page aligned, bad blocks are skipped like the tools do */
+    int read(uint64_t offset, std::span<std::byte> buf) noexcept
+    {
+        return s_ != nullptr ? nand_session_dump(s_, buf.data(), buf.size(), offset) : -1;
+    }
+
+    int write(uint64_t offset, std::span<const std::byte> data) noexcept
+    {
+        return s_ != nullptr ? nand_session_write(s_, data.data(), data.size(), offset) : -1;
+    }
+
+    int erase(uint64_t offset, uint64_t len) noexcept
+    {
+        return s_ != nullptr ? nand_session_erase(s_, offset, len) : -1;
+    }
+
+    /* 1 if the eraseblock holding offset is bad */
+    int is_bad(uint64_t offset) noexcept
+    {
+        return s_ != nullptr ? nand_block_isbad(s_, offset) : -1;
+    }
+
+private:
+    nand_session_t *s_ = nullptr;
+};
+
+/* preserved data records over a few eraseblocks of an open device, see nand_log.h */
+class NandLog
+{
+public:
+    /* the device has to stay open as long as the log is used */
+    int open(NandDevice &dev, uint64_t offset, uint32_t nblocks) noexcept
+    {
+        open_ = dev.is_open() && nand_log_open(&log_, dev.session(), offset, nblocks) == 0;
+        return open_ ? 0 : -1;
+    }
+
+    bool is_open() const noexcept { return open_; }
+    explicit operator bool() const noexcept { return is_open(); }
+
+    /* payload length of the newest record, 0 if there is none */
+    int read(std::span<std::byte> buf) noexcept
+    {
+        return open_ && buf.size() <= UINT16_MAX ? nand_log_read(&log_, buf.data(), (uint16_t)buf.size()) : -1;
+    }
+
+    int append(std::span<const std::byte> data) noexcept
+    {
+        return open_ && data.size() <= UINT16_MAX ? nand_log_append(&log_, data.data(), (uint16_t)data.size()) : -1;
+    }
+
+    /* erase the slot the next append moves to, off the update's critical path */
+    int reclaim() noexcept { return open_ ? nand_log_reclaim(&log_) : -1; }
+
+    /* 0 when not open, like for an offset outside the log */
+    uint32_t erase_count(uint64_t offset) noexcept { return open_ ? nand_log_erase_count(&log_, offset) : 0; }
+    uint32_t seq() const noexcept { return log_.seq; }
+
+private:
+    nand_log_t log_{};
+    bool open_ = false;
+};
+
+}
+
+#endif
@@ -0,0 +1,176 @@
+#include <pthread.h>
+#include "nand_jobs.h"
+
+/* jobs of one device, in the order they were given */
+struct nand_job_queue
+{
+    const char      *device_name;
+    nand_job_t      *jobs[NAND_JOBS_MAX];
+    unsigned int    njobs;
+};
+
+struct nand_job_pool
+{
+    struct nand_job_queue   queues[NAND_JOBS_MAX];
+    unsigned int            nqueues;
+    unsigned int            next;           /* next queue to hand to a worker */
+    pthread_mutex_t         lock;
+};
+
+/* whole field as an unsigned number, strtoull alone takes "-1" and trailing garbage */
+static int parse_u64(const char *str, uint64_t *val)
+{
+    char *end;
+
+    errno = 0;
+    *val = strtoull(str, &end, 0);
+    if (*str == '\0' || *str == '-' || *end != '\0' || errno != 0)
+        return -1;
+    return 0;
+}
+
+int nand_job_parse(nand_job_t *job, char *spec)
+{
+    uint64_t len;
+
+    char *field[5];
+    int n = 0;
+    char *save = NULL;
+    char *tok;
+
+    memset(job, 0, sizeof(*job));
+    for (tok = strtok_r(spec, ":", &save); tok != NULL && n < 5; tok = strtok_r(NULL, ":", &save))
+        field[n++] = tok;
+
+    if (n < 4)
+        goto bad;
+
+    job->device_name = field[1];
+    if (parse_u64(field[2], &job->offset) < 0)
+        goto bad;
+
+    if (!strcmp(field[0], "erase") && n == 4) {
+        /* a typo must not turn into an erase of the whole device */
+        if (parse_u64(field[3], &len) < 0 || len == 0 || len > INT64_MAX)
+            goto bad;
+        job->op = NAND_JOB_ERASE;
+        job->len = len;
+    } else if (!strcmp(field[0], "write") && n == 4) {
+        job->op = NAND_JOB_WRITE;
+        job->file_name = field[3];
+    } else if (!strcmp(field[0], "dump") && n == 5) {
+        if (parse_u64(field[3], &len) < 0 || len > INT64_MAX)
+            goto bad;
+        job->op = NAND_JOB_DUMP;
+        job->len = len;
+        job->file_name = field[4];
+    } else {
+        goto bad;
+    }
+    return 0;
+
+bad:
+    nand_msg("bad job, use erase:dev:offset:len, write:dev:offset:file or dump:dev:offset:len:file\n");
+    return -1;
+}
+
+static int run_job(nand_session_t *s, nand_job_t *job)
+{
+    /* the device size is only known once it is open */
+    if (job->offset >= s->size || (uint64_t)job->len > s->size - job->offset) {
+        nand_msg("%s: job 0x%llx+0x%llx past the end of the device (0x%llx)\n", job->device_name,
+                 (unsigned long long)job->offset, (unsigned long long)job->len, (unsigned long long)s->size);
+        return -1;
+    }
+
+    switch (job->op) {
+    case NAND_JOB_ERASE:
+        return nand_session_erase(s, job->offset, job->len);
+    case NAND_JOB_WRITE:
+        return nand_session_write_file(s, job->file_name, job->offset);
+    case NAND_JOB_DUMP:
+        return nand_session_dump_file(s, job->file_name, job->len, job->offset);
+    }
+    return -1;
+}
+
+/* takes whole device queues, so one device is only ever driven by one thread */
+static void *job_worker(void *arg)
+{
+    struct nand_job_pool *pool = (struct nand_job_pool *)arg;
+    struct nand_job_queue *q;
+    nand_session_t *s;
+    unsigned int i;
+
+    while (1) {
+        pthread_mutex_lock(&pool->lock);
+        q = pool->next < pool->nqueues ? &pool->queues[pool->next++] : NULL;
+        pthread_mutex_unlock(&pool->lock);
+        if (q == NULL)
+            break;
+
+        s = nand_open(q->device_name);
+        for (i = 0; i < q->njobs; i++) {
+            /* a failed job stops the jobs after it on the same device */
+            if (s == NULL || (i > 0 && q->jobs[i - 1]->status < 0)) {
+                q->jobs[i]->status = -1;
+                continue;
+            }
+            q->jobs[i]->status = run_job(s, q->jobs[i]);
+            nand_msg("%s: job %u %s\n", q->device_name, i, q->jobs[i]->status == 0 ? "done" : "failed");
+        }
+        nand_close(s);
+    }
+    return NULL;
+}
+
+int nand_run_jobs(nand_job_t *jobs, unsigned int njobs, unsigned int nworkers)
+{
+    struct nand_job_pool pool;
+    pthread_t threads[NAND_JOBS_MAX];
+    unsigned int i, q;
+    int ret = 0;
+
+    if (njobs > NAND_JOBS_MAX) {
+        nand_msg("too many jobs, max %d\n", NAND_JOBS_MAX);
+        return -1;
+    }
+
+    memset(&pool, 0, sizeof(pool));
+    pthread_mutex_init(&pool.lock, NULL);
+
+    for (i = 0; i < njobs; i++) {
+        for (q = 0; q < pool.nqueues; q++) {
+            if (!strcmp(pool.queues[q].device_name, jobs[i].device_name))
+                break;
+        }
+        if (q == pool.nqueues)
+            pool.queues[pool.nqueues++].device_name = jobs[i].device_name;
+        pool.queues[q].jobs[pool.queues[q].njobs++] = &jobs[i];
+        jobs[i].status = -1;
+    }
+
+    if (nworkers == 0 || nworkers > pool.nqueues)
+        nworkers = pool.nqueues;
+
+    for (i = 0; i < nworkers; i++) {
+        if (pthread_create(&threads[i], NULL, job_worker, &pool) != 0) {
+            nand_msg("create job worker failed!\n");
+            break;
+        }
+    }
+    /* with no thread at all, run the jobs here */
+    if (i == 0)
+        job_worker(&pool);
+    nworkers = i;
+    for (i = 0; i < nworkers; i++)
+        pthread_join(threads[i], NULL);
+
+    pthread_mutex_destroy(&pool.lock);
+
+    for (i = 0; i < njobs; i++) {
+        if (jobs[i].status < 0)
+            ret = -1;
+    }
+    return ret;
+}
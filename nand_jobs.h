@@ -0,0 +1,48 @@
+#ifndef NAND_JOBS_H
+#define NAND_JOBS_H
+
+#include "nand.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Erase/write/dump jobs over several mtd devices. Jobs on different devices
+ * run concurrently on a pool of worker threads, jobs on the same device run
+ * in the order they were given, on one session.
+ */
+
+#define NAND_JOBS_MAX       32
+
+typedef enum nand_job_op
+{
+    NAND_JOB_ERASE,                         /* len bytes from offset, len > 0 */
+    NAND_JOB_WRITE,                         /* write_file of file_name at offset */
+    NAND_JOB_DUMP                           /* dump_file of len bytes (0 to the end) into file_name */
+}nand_job_op_t;
+
+typedef struct nand_job
+{
+    nand_job_op_t   op;
+    const char      *device_name;
+    const char      *file_name;
+    uint64_t        offset;
+    int64_t         len;
+    int             status;                 /* result of the job, set by nand_run_jobs */
+}nand_job_t;
+
+/*
+ * parse "erase:dev:offset:len", "write:dev:offset:file" or "dump:dev:offset:len:file",
+ * spec is modified. Numbers must be whole and not negative; offset + len is
+ * checked against the device size when the job runs.
+ */
+int nand_job_parse(nand_job_t *job, char *spec);
+/* run the jobs on up to nworkers threads, 0 if every job succeeded */
+int nand_run_jobs(nand_job_t *jobs, unsigned int njobs, unsigned int nworkers);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,351 @@
+#include "nand_log.h"
+#include "nand_crc.h"
+
+static uint16_t record_crc(const nand_log_hdr_t *hdr, const void *data)
+{
+    nand_log_hdr_t tmp = *hdr;
+    uint16_t crc;
+
+    tmp.crc = 0;
+    crc = nand_crc16(&tmp, sizeof(tmp), 0);
+    return nand_crc16(data, hdr->len, crc);
+}
+
+static uint64_t page_offset(nand_log_t *log, uint32_t slot, uint32_t page)
+{
+    return log->slot_offset[slot] + page * log->s->meminfo.writesize;
+}
+
+/* index of the slot's eraseblock within the region */
+static uint32_t slot_block(nand_log_t *log, uint32_t slot)
+{
+    return (uint32_t)((log->slot_offset[slot] - log->offset) / log->s->meminfo.erasesize);
+}
+
+static uint16_t wear_crc(const nand_log_wear_t *wear)
+{
+    nand_log_wear_t tmp = *wear;
+
+    tmp.crc = 0;
+    return nand_crc16(&tmp, sizeof(tmp), 0);
+}
+
+/* erase count table sits at the very end of a record page */
+static nand_log_wear_t *page_wear(nand_log_t *log)
+{
+    return (nand_log_wear_t *)(log->s->page_buf + log->s->meminfo.writesize - sizeof(nand_log_wear_t));
+}
+
+static void fill_wear(nand_log_t *log)
+{
+    nand_log_wear_t wear;
+    uint32_t slot;
+
+    memset(&wear, 0, sizeof(wear));
+    wear.magic = NAND_LOG_WEAR_MAGIC;
+    wear.nblocks = log->nblocks;
+    for (slot = 0; slot < log->nslots; slot++) {
+        if (log->slot_used[slot] || slot == log->cur)
+            wear.used |= 1u << slot_block(log, slot);
+    }
+    memcpy(wear.erase_count, log->erase_count, log->nblocks * sizeof(uint32_t));
+    wear.crc = wear_crc(&wear);
+    memcpy(page_wear(log), &wear, sizeof(wear));
+}
+
+/*
+ * Take the erase counts from the record in the scratch page, records without
+ * a table count from 0. A block that held records when it was written and is
+ * erased now was erased after it, usually by the reclaim right behind the
+ * append, so it is counted here.
+ */
+static void load_wear(nand_log_t *log)
+{
+    nand_log_wear_t wear;
+    uint32_t slot;
+
+    memcpy(&wear, page_wear(log), sizeof(wear));
+    if (wear.magic != NAND_LOG_WEAR_MAGIC || wear.nblocks > NAND_LOG_MAX_SLOTS || wear_crc(&wear) != wear.crc)
+        return;
+    memcpy(log->erase_count, wear.erase_count, wear.nblocks * sizeof(uint32_t));
+
+    for (slot = 0; slot < log->nslots; slot++) {
+        if ((wear.used & (1u << slot_block(log, slot))) && !log->slot_used[slot])
+            log->erase_count[slot_block(log, slot)]++;
+    }
+}
+
+/* read one page of the log into the session scratch page */
+static int read_page(nand_log_t *log, uint32_t slot, uint32_t page)
+{
+    uint32_t writesize = log->s->meminfo.writesize;
+
+    if (log->s->ops->pread(log->s->fd, log->s->page_buf, writesize, page_offset(log, slot, page)) != (ssize_t)writesize) {
+        nand_msg("nand_log: read block 0x%08llx page %u failed!\n", (unsigned long long)log->slot_offset[slot], page);
+        return -1;
+    }
+    return 0;
+}
+
+/* 1 if the scratch page holds a valid record, its header is copied to hdr */
+static int check_record(nand_log_t *log, nand_log_hdr_t *hdr)
+{
+    memcpy(hdr, log->s->page_buf, sizeof(*hdr));
+
+    if (hdr->magic != NAND_LOG_MAGIC || hdr->len > log->s->meminfo.writesize - sizeof(*hdr))
+        return 0;
+    return record_crc(hdr, log->s->page_buf + sizeof(*hdr)) == hdr->crc;
+}
+
+/* keep the record in the scratch page if it is newer than the newest so far */
+static void track_newest(nand_log_t *log, uint32_t slot, uint32_t page)
+{
+    nand_log_hdr_t hdr;
+
+    if (check_record(log, &hdr) && (!log->valid || (int32_t)(hdr.seq - log->seq) > 0)) {
+        log->valid = true;
+        log->seq = hdr.seq;
+        log->head_slot = slot;
+        log->head_page = page;
+    }
+}
+
+/*
+ * Pages of a slot are only ever programmed in order, so the programmed pages
+ * are a prefix of the slot. Binary search for the first erased page, then walk
+ * back from it to the last page that passes the CRC, which is the newest
+ * record of the slot. A programmed page that fails the CRC is a torn write,
+ * used space but never the newest record. O(log pages) page reads unless
+ * writes were torn. Returns the first free page.
+ */
+static int scan_slot(nand_log_t *log, uint32_t slot)
+{
+    uint32_t lo = 0, hi = log->pages, mid;
+    uint32_t page;
+    nand_log_hdr_t hdr;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (read_page(log, slot, mid) < 0)
+            return -1;
+        if (nand_is_erased(log->s->page_buf, log->s->meminfo.writesize))
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+
+    for (page = lo; page > 0; page--) {
+        if (read_page(log, slot, page - 1) < 0)
+            return -1;
+        if (check_record(log, &hdr)) {
+            track_newest(log, slot, page - 1);
+            break;
+        }
+    }
+    return lo;
+}
+
+static int erase_slot(nand_log_t *log, uint32_t slot)
+{
+    if (nand_block_erase(log->s, log->slot_offset[slot]) < 0)
+        return -1;
+    log->slot_used[slot] = false;
+    /* persisted with the next record, or found by load_wear at the next open */
+    log->erase_count[slot_block(log, slot)]++;
+    return 0;
+}
+
+/*
+ * Slot the log moves to when the current one is full: an erased one if there
+ * is any, else the used one erased least often, never the current slot or
+ * the one with the newest record. Ties go to the first one after the current
+ * slot, so blocks of equal wear keep rotating. nslots if there is none.
+ */
+static uint32_t next_slot(nand_log_t *log)
+{
+    uint32_t best = log->nslots;
+    uint32_t i, slot;
+
+    for (i = 1; i < log->nslots; i++) {
+        slot = (log->cur + i) % log->nslots;
+        if (log->valid && slot == log->head_slot)
+            continue;
+        if (best == log->nslots ||
+            (!log->slot_used[slot] && log->slot_used[best]) ||
+            (log->slot_used[slot] == log->slot_used[best] &&
+             log->erase_count[slot_block(log, slot)] < log->erase_count[slot_block(log, best)]))
+            best = slot;
+    }
+    return best;
+}
+
+int nand_log_open(nand_log_t *log, nand_session_t *s, uint64_t offset, uint32_t nblocks)
+{
+    uint32_t block, slot, newest = NAND_LOG_MAX_SLOTS;
+    uint32_t newest_seq = 0;
+    int first_free[NAND_LOG_MAX_SLOTS];
+    nand_log_hdr_t hdr;
+    int ret;
+
+    memset(log, 0, sizeof(*log));
+    log->s = s;
+    log->pages = s->meminfo.erasesize / s->meminfo.writesize;
+
+    if (s->meminfo.writesize <= sizeof(nand_log_hdr_t) + sizeof(nand_log_wear_t)) {
+        nand_msg("nand_log: page size %d too small\n", s->meminfo.writesize);
+        return -1;
+    }
+
+    offset &= ~(uint64_t)(s->meminfo.erasesize - 1);
+    log->offset = offset;
+    for (block = 0; block < nblocks && block < NAND_LOG_MAX_SLOTS; block++) {
+        uint64_t blockstart = offset + (uint64_t)block * s->meminfo.erasesize;
+
+        if (blockstart >= s->size)
+            break;
+        log->nblocks = block + 1;
+        ret = nand_block_isbad(s, blockstart);
+        if (ret < 0)
+            return -1;
+        if (ret == 0)
+            log->slot_offset[log->nslots++] = blockstart;
+    }
+
+    if (log->nslots < 2) {
+        nand_msg("nand_log: need two good blocks at 0x%08llx, have %u\n", (unsigned long long)offset, log->nslots);
+        return -1;
+    }
+
+    /*
+     * Slots fill one at a time, so the slot whose page 0 record is newest
+     * holds the newest records. Only a slot with a torn page 0 has to be
+     * searched on its own.
+     */
+    for (slot = 0; slot < log->nslots; slot++) {
+        if (read_page(log, slot, 0) < 0)
+            return -1;
+        first_free[slot] = log->pages;
+        if (nand_is_erased(s->page_buf, s->meminfo.writesize)) {
+            first_free[slot] = 0;
+        } else if (check_record(log, &hdr)) {
+            if (newest == NAND_LOG_MAX_SLOTS || (int32_t)(hdr.seq - newest_seq) > 0) {
+                newest = slot;
+                newest_seq = hdr.seq;
+            }
+        } else if ((first_free[slot] = scan_slot(log, slot)) < 0) {
+            return -1;
+        }
+        log->slot_used[slot] = first_free[slot] > 0;
+    }
+
+    if (newest != NAND_LOG_MAX_SLOTS && (first_free[newest] = scan_slot(log, newest)) < 0)
+        return -1;
+
+    /* the newest record carries the erase counts */
+    if (log->valid) {
+        if (read_page(log, log->head_slot, log->head_page) < 0)
+            return -1;
+        load_wear(log);
+    }
+
+    /* append after the newest record */
+    log->cur = log->valid ? log->head_slot : 0;
+    log->next_page = first_free[log->cur];
+
+    return 0;
+}
+
+int nand_log_read(nand_log_t *log, void *data, uint16_t len)
+{
+    nand_log_hdr_t hdr;
+
+    if (!log->valid)
+        return 0;
+
+    if (read_page(log, log->head_slot, log->head_page) < 0)
+        return -1;
+    if (!check_record(log, &hdr)) {
+        nand_msg("nand_log: record at block 0x%08llx page %u went bad\n",
+               (unsigned long long)log->slot_offset[log->head_slot], log->head_page);
+        return -1;
+    }
+
+    memcpy(data, log->s->page_buf + sizeof(hdr), len < hdr.len ? len : hdr.len);
+    return hdr.len;
+}
+
+int nand_log_append(nand_log_t *log, const void *data, uint16_t len)
+{
+    nand_session_t *s = log->s;
+    uint32_t writesize = s->meminfo.writesize;
+    nand_log_hdr_t hdr;
+
+    if (len > writesize - sizeof(hdr) - sizeof(nand_log_wear_t)) {
+        nand_msg("nand_log: record of %u bytes does not fit a page\n", len);
+        return -1;
+    }
+
+    /* slot is full, move on to the next one, normally erased by reclaim already */
+    if (log->next_page >= log->pages) {
+        uint32_t next = next_slot(log);
+
+        if (next >= log->nslots) {
+            nand_msg("nand_log: no free block left\n");
+            return -1;
+        }
+        if (log->slot_used[next] && erase_slot(log, next) < 0)
+            return -1;
+        log->cur = next;
+        log->next_page = 0;
+    }
+
+    hdr.magic = NAND_LOG_MAGIC;
+    hdr.seq = log->valid ? log->seq + 1 : 0;
+    hdr.len = len;
+    hdr.crc = record_crc(&hdr, data);
+
+    memset(s->page_buf, 0xFF, writesize);
+    memcpy(s->page_buf, &hdr, sizeof(hdr));
+    memcpy(s->page_buf + sizeof(hdr), data, len);
+    fill_wear(log);
+
+    log->slot_used[log->cur] = true;
+    if (s->ops->pwrite(s->fd, s->page_buf, writesize, page_offset(log, log->cur, log->next_page)) != (ssize_t)writesize) {
+        nand_msg("nand_log: program block 0x%08llx page %u failed!\n", (unsigned long long)log->slot_offset[log->cur], log->next_page);
+        /*
+         * A torn page is used space, skip it. A page the failed program left
+         * erased is taken again by the next append, open relies on the
+         * programmed pages being a prefix of the slot.
+         */
+        if (read_page(log, log->cur, log->next_page) < 0 || !nand_is_erased(s->page_buf, writesize))
+            log->next_page++;
+        else if (log->next_page == 0)
+            log->slot_used[log->cur] = false;
+        return -1;
+    }
+
+    log->head_slot = log->cur;
+    log->head_page = log->next_page++;
+    log->seq = hdr.seq;
+    log->valid = true;
+    return 0;
+}
+
+int nand_log_reclaim(nand_log_t *log)
+{
+    uint32_t next = next_slot(log);
+
+    /* next_slot never picks the slot holding the newest record */
+    if (next >= log->nslots || !log->slot_used[next])
+        return 0;
+    return erase_slot(log, next);
+}
+
+uint32_t nand_log_erase_count(nand_log_t *log, uint64_t offset)
+{
+    uint64_t block = (offset - log->offset) / log->s->meminfo.erasesize;
+
+    if (offset < log->offset || block >= log->nblocks)
+        return 0;
+    return log->erase_count[block];
+}
@@ -0,0 +1,81 @@
+#ifndef NAND_LOG_H
+#define NAND_LOG_H
+
+#include "nand.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Append-only record log over a small region of eraseblocks (slots). Every
+ * update programs the next free page with a sequence numbered, CRC protected
+ * record. When a slot is full the next record goes to page 0 of another
+ * slot, picked by wear: an erased one if there is any, else the one erased
+ * least often, which nand_log_reclaim erases ahead of time. The newest
+ * record is never erased or overwritten by an update, so a power cut at any
+ * point leaves either the old or the new record readable.
+ *
+ * Every record page ends with the erase counts of the region's blocks, the
+ * newest record carries the current table. At open page 0 of every slot
+ * tells which slot holds the newest generation, only that one is searched.
+ */
+
+#define NAND_LOG_MAGIC      0x474F4C4E      /* "NLOG" */
+#define NAND_LOG_WEAR_MAGIC 0x5245574E      /* "NWER" */
+#define NAND_LOG_MAX_SLOTS  16
+
+/* record header at the start of a page, the payload follows it */
+typedef struct nand_log_hdr
+{
+    uint32_t    magic;
+    uint32_t    seq;                        /* increments with every record */
+    uint16_t    len;                        /* payload bytes */
+    uint16_t    crc;                        /* nand_crc16 of header with crc = 0, then payload */
+}nand_log_hdr_t;
+
+/* erase count table at the end of every record page, outside the record crc */
+typedef struct nand_log_wear
+{
+    uint32_t    magic;
+    uint16_t    nblocks;                    /* entries in use, one per eraseblock of the region */
+    uint16_t    crc;                        /* nand_crc16 of the table with crc = 0 */
+    uint16_t    used;                       /* blocks holding records when it was written, bit per block */
+    uint16_t    reserved;
+    uint32_t    erase_count[NAND_LOG_MAX_SLOTS];
+}nand_log_wear_t;
+
+typedef struct nand_log
+{
+    nand_session_t  *s;
+    uint64_t        offset;                 /* start of the region */
+    uint32_t        nblocks;                /* eraseblocks in the region, bad ones included */
+    uint32_t        erase_count[NAND_LOG_MAX_SLOTS];    /* per eraseblock of the region */
+    uint32_t        pages;                  /* pages per eraseblock */
+    uint32_t        nslots;                 /* good eraseblocks in the region */
+    uint64_t        slot_offset[NAND_LOG_MAX_SLOTS];
+    bool            slot_used[NAND_LOG_MAX_SLOTS];  /* slot has programmed pages */
+    uint32_t        cur;                    /* slot being appended to */
+    uint32_t        next_page;              /* first free page of cur, pages when full */
+    uint32_t        head_slot;              /* slot and page of the newest valid record */
+    uint32_t        head_page;
+    uint32_t        seq;                    /* sequence of the newest valid record */
+    bool            valid;                  /* a valid record was found */
+}nand_log_t;
+
+/* use the good blocks among nblocks (up to NAND_LOG_MAX_SLOTS) eraseblocks from offset, at least two */
+int nand_log_open(nand_log_t *log, nand_session_t *s, uint64_t offset, uint32_t nblocks);
+/* copy the newest record, returns its payload length, 0 if there is none, -1 on error */
+int nand_log_read(nand_log_t *log, void *data, uint16_t len);
+/* program a new record into the next free page, never erases the newest record */
+int nand_log_append(nand_log_t *log, const void *data, uint16_t len);
+/* erase the slot the log moves to next if it still holds old records */
+int nand_log_reclaim(nand_log_t *log);
+/* times the block at offset was erased since the log started counting */
+uint32_t nand_log_erase_count(nand_log_t *log, uint64_t offset);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
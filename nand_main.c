@@ -1,8 +1,14 @@
 #include "nand.h"
+#include "nand_sim.h"
+#include "nand_crc.h"
+#include "nand_log.h"
+#include "nand_jobs.h"
+#include "nand_stats.h"
 
 /* mtd device */
 #define NAND_DATA_DEV       "/dev/mtd2"
 #define NAND_FLASH_OFFSET   0
+#define NAND_LOG_BLOCKS     4   /* eraseblocks the preserved data log spreads its wear over */
 
 /* Option definitions */
 enum type_option{
@@ -13,10 +19,24 @@ enum type_option{
 };
 
 static void process_options(int argc, char const *argv[]);
-static uint16_t compute_crc(const void *DataPtr, uint16_t DataLength, uint16_t InputCRC);
+static nand_session_t *open_log(nand_log_t *log);
+static int read_preserved(nand_log_t *log, nand_session_t *session);
+static void print_stats(void);
 
 /* Options */
 static int8_t type = -1; /* type to execute write/erase/dump */
+static const char *device_name = NAND_DATA_DEV; /* mtd device, or simulator backing file */
+static const char *image_name = NULL; /* image file to flash instead of the test structure */
+static uint64_t mtd_offset = NAND_FLASH_OFFSET; /* device offset of the image */
+static int64_t image_len = 0; /* bytes to dump into the image, 0 for up to the end */
+static unsigned int nand_flags = 0; /* NAND_F_* for the sessions */
+static const char *bbt_cache = NULL; /* bad block table cache file */
+static nand_job_t jobs[NAND_JOBS_MAX]; /* jobs over several devices, run instead of -t */
+static unsigned int njobs = 0;
+static unsigned int nworkers = 0; /* job threads, 0 for one per device */
+static bool erase_first = false; /* erase the image blocks while writing it */
+static bool stats = false; /* print call counters and latency histograms as JSON to stderr on exit */
+static int oob_mode = -1; /* MTD_OPS_* when the image carries oob after every page, -1 for main area only */
 
 /* Example GENSAT-1 Info to Save */
 typedef struct _GENSAT_1_cFS_preserved_data_
@@ -36,120 +56,195 @@ GENSAT_1_cFS_preserved_data * ptest = &test;
 
 int main(int argc, char const *argv[])
 {
-    if(argc != 3)
+    if(argc < 3)
     {
-        printf("Usage: .exe -t {w|d|e|u}\n");      
-        printf("Usage: .exe -type {write|dump|erase|update}\n");
+        printf("Usage: .exe -t {w|d|e|u} [-s sim_image] [-B bbt_file] [-f image [-o offset] [-l length] [-b] [-p] [-E] [-D] [-O raw|auto|place] [-H|-Z]] [-k] [-V] [-S]\n");      
+        printf("Usage: .exe -type {write|dump|erase|update} [--sim sim_image] [--bbt bbt_file] [--file image [--offset offset] [--length length] [--batch] [--pipeline] [--erase] [--delta] [--oob raw|auto|place] [--holes|--sparse]] [--skip-blank] [--verify] [--stats]\n");
+        printf("Usage: .exe -j erase:dev:offset:len -j write:dev:offset:file -j dump:dev:offset:len:file ... [-w workers] [-s sim, job devices are sim images]\n");
         exit(EXIT_FAILURE);
     }
 
     process_options(argc, argv);
     int32_t status  = 0;
     
-    if(type == NAND_WRITE)
+    nand_set_flags(nand_flags);
+
+    if(stats)
     {
+        /* time every device call, reported however the program exits */
+        nand_set_dev_ops(nand_stats_wrap(nand_get_dev_ops()));
+        atexit(print_stats);
+    }
+
+    if(njobs > 0)
+    {
+        unsigned int i;
+
+        /* one cache file can only describe one device */
+        for(i = 1; bbt_cache != NULL && i < njobs; i++)
+        {
+            if(strcmp(jobs[i].device_name, jobs[0].device_name))
+            {
+                printf("-B can't be used with jobs on more than one device\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        status = nand_run_jobs(jobs, njobs, nworkers);
+        printf("NAND_JOBS: %s\n", status == 0 ? "all done" : "failed");
+        return status == 0 ? 0 : EXIT_FAILURE;
+    }
+
+    if(type == NAND_WRITE && image_name != NULL)
+    {
+        if(oob_mode >= 0)
+            status = nand_write_oob_file(device_name, image_name, mtd_offset, oob_mode);
+        else if(erase_first)
+            status = nand_erase_write_file(device_name, image_name, mtd_offset);
+        else
+            status = nand_write_file(device_name, image_name, mtd_offset);
+        printf("NAND_WRITE: %s %s\n", image_name, status == 0 ? "written" : "failed");
+    }
+    else if(type == NAND_WRITE)
+    {
+        nand_log_t log;
+        nand_session_t *session = open_log(&log);
+
         if(ptest->deploy_state == 0)
         {
             ptest->deploy_state++;
         }
         ptest->num_launch_state++;
-        ptest->crc_check = compute_crc((const void *)ptest, sizeof(int16_t)*2, 0);
+        ptest->crc_check = nand_crc16((const void *)ptest, sizeof(int16_t)*2, 0);
         ptest->spare = 0;
 
-        status = nand_write(NAND_DATA_DEV, (const void *)ptest, sizeof(GENSAT_1_cFS_preserved_data), NAND_FLASH_OFFSET); 
+        status = nand_log_append(&log, (const void *)ptest, sizeof(GENSAT_1_cFS_preserved_data));
+        if(status == 0)
+        {
+            nand_log_reclaim(&log);
+        }
+        nand_close(session);
         printf("NAND_WRITE\n");
     }
+    else if(type == NAND_DUMP && image_name != NULL)
+    {
+        if(oob_mode >= 0)
+            status = nand_dump_oob_file(device_name, image_name, image_len, mtd_offset, oob_mode);
+        else
+            status = nand_dump_file(device_name, image_name, image_len, mtd_offset);
+        printf("NAND_DUMP: %s %s\n", image_name, status == 0 ? "written" : "failed");
+    }
     else if(type == NAND_DUMP)
     {
-        status = nand_dump(NAND_DATA_DEV, ptest, sizeof(GENSAT_1_cFS_preserved_data), NAND_FLASH_OFFSET);
+        nand_log_t log;
+        nand_session_t *session = open_log(&log);
+
+        status = read_preserved(&log, session);
+        nand_close(session);
+
+        printf("erase counts:");
+        for(uint32_t i = 0; i < log.nblocks; i++)
+        {
+            printf(" %u", log.erase_count[i]);
+        }
+        printf("\n");
 
         if(status == 0)
         {
-            uint16_t crc_local = compute_crc((const void *)ptest, sizeof(int16_t)*2, 0);
+            printf("no preserved data record\n");
+        }
+        else if(status > 0)
+        {
+            uint16_t crc_local = nand_crc16((const void *)ptest, sizeof(int16_t)*2, 0);
             if(crc_local != ptest->crc_check)
             {
                 printf("miss match crc!\n");
             }
-            printf("deploy_state %d, num_launch_state %d\n", ptest->deploy_state, ptest->num_launch_state);
+            printf("deploy_state %d, num_launch_state %d, record %u\n", ptest->deploy_state, ptest->num_launch_state, log.seq);
         }
         printf("NAND_DUMP\n");
     }
     else if(type == NAND_ERASE)
     {
-        status = nand_erase(NAND_DATA_DEV, NAND_FLASH_OFFSET, sizeof(GENSAT_1_cFS_preserved_data));
+        nand_session_t *session = nand_open(device_name);
+
+        status = -1;
+        if(session != NULL)
+        {
+            status = nand_session_erase(session, NAND_FLASH_OFFSET, NAND_LOG_BLOCKS * session->meminfo.erasesize);
+            nand_close(session);
+        }
         printf("NAND_ERASE\n");
     }
     /* update the test structure */
     else if(type == NAND_UPDATE)
     {
-        /* First step: Dump and verify the NAND data */
-        status = nand_dump(NAND_DATA_DEV, ptest, sizeof(GENSAT_1_cFS_preserved_data), NAND_FLASH_OFFSET);
+        /* one session for the whole update, the device is opened and queried once */
+        nand_log_t log;
+        nand_session_t *session = open_log(&log);
 
-        if(status == 0)
+        /* First step: read and verify the newest record */
+        status = read_preserved(&log, session);
+
+        if(status < 0)
         {
+            printf("NAND_UPDATE: failed to read NAND data, exit!\n");
+            nand_close(session);
+            exit(EXIT_FAILURE);
+        }
 
-            /* Check if the NAND Flash is used*/
+        /* Check if the NAND Flash is used*/
+        if(status == 0)
+        {
+            printf("First Launch of cFS, initialize NAND data!\n");
+            ptest->deploy_state = 0;
+            ptest->num_launch_state = 1;
+            ptest->crc_check = nand_crc16((const void *)ptest, sizeof(int16_t)*2, 0);
+            ptest->spare = 0;
+            printf("deploy_state %d, num_launch_state %d\n", ptest->deploy_state, ptest->num_launch_state);
+        }
+        else
+        {
+            uint16_t crc_local = nand_crc16((const void *)ptest, sizeof(int16_t)*2, 0);
 
-            if(ptest->deploy_state == 0xFF || ptest->num_launch_state == 0xFF || ptest->crc_check == 0xFF || ptest->spare == 0xFF)
+            if(crc_local != ptest->crc_check)
             {
-                printf("First Launch of cFS, initialize NAND data!\n");
-                ptest->deploy_state = 0;
-                ptest->num_launch_state = 1;
-                ptest->crc_check = compute_crc((const void *)ptest, sizeof(int16_t)*2, 0);
-                ptest->spare = 0;
-                printf("deploy_state %d, num_launch_state %d\n", ptest->deploy_state, ptest->num_launch_state);
+                printf("Miss Match CRC!\n");
+                nand_close(session);
+                exit(EXIT_FAILURE);
             }
-            else
-            {
-                uint16_t crc_local = compute_crc((const void *)ptest, sizeof(int16_t)*2, 0);
-
-                if(crc_local != ptest->crc_check)
-                {
-                    printf("Miss Match CRC!\n");
-                    exit(EXIT_FAILURE);
-                }
 
-                /* Update NAND Flash */
-                if(ptest->deploy_state == 0)
-                {
-                    ptest->deploy_state = 1;
-                }
-                ptest->num_launch_state++;
-                ptest->crc_check = compute_crc((const void *)ptest, sizeof(int16_t)*2, 0);
-                ptest->spare = 0;
-
-                printf("deploy_state %d, num_launch_state %d\n", ptest->deploy_state, ptest->num_launch_state);
+            /* Update NAND Flash */
+            if(ptest->deploy_state == 0)
+            {
+                ptest->deploy_state = 1;
             }
+            ptest->num_launch_state++;
+            ptest->crc_check = nand_crc16((const void *)ptest, sizeof(int16_t)*2, 0);
+            ptest->spare = 0;
 
-            /* Erase the NAND flash block so we can write to it*/
-            status = nand_erase(NAND_DATA_DEV, NAND_FLASH_OFFSET, sizeof(GENSAT_1_cFS_preserved_data));
+            printf("deploy_state %d, num_launch_state %d\n", ptest->deploy_state, ptest->num_launch_state);
+        }
 
-            if(status == 0)
-            {
-                status = nand_write(NAND_DATA_DEV, (const void *)ptest, sizeof(GENSAT_1_cFS_preserved_data), NAND_FLASH_OFFSET); 
+        /* one page program into an erased page, the old record stays intact */
+        status = nand_log_append(&log, (const void *)ptest, sizeof(GENSAT_1_cFS_preserved_data));
 
-                if(status == 0)
-                {
-                    printf("NAND_UPDATE: NAND_WRITE success\n");
-                }
-                else
-                {
-                    printf("NAND_UPDATE: NAND_WRITE failed\n");
-                }
-            }
-            else
+        if(status == 0)
+        {
+            printf("NAND_UPDATE: NAND_WRITE success\n");
+
+            /* the new record is safe, now erase the block the log moves to next */
+            if(nand_log_reclaim(&log) < 0)
             {
-                printf("NAND_UPDATE: NAND_ERASE failed to Erase\n");
+                printf("NAND_UPDATE: erase ahead failed, retried on the next update\n");
             }
-
         }
         else
         {
-            printf("NAND_UPDATE: failed to dump NAND data, exit!\n");
-            exit(EXIT_FAILURE);
+            printf("NAND_UPDATE: NAND_WRITE failed\n");
         }
 
-
+        nand_close(session);
     }
     else
         perror("Invalid NAND Operation\n");
@@ -159,68 +254,57 @@ int main(int argc, char const *argv[])
 }
 
 
-static uint16_t compute_crc(void *DataPtr, uint16_t DataLength, uint16_t InputCRC)
+/* stdout carries the progress lines, the JSON alone goes to stderr so it can be parsed */
+static void print_stats(void)
+{
+    nand_stats_report(stderr);
+}
+
+/* session and record log holding the preserved data, exits when either fails */
+static nand_session_t *open_log(nand_log_t *log)
 {
-    uint32_t  i;
-    int16_t  Index;
-    int16_t Crc = 0;
-    const uint8_t *BufPtr;
-    uint8_t  ByteValue;
+    nand_session_t *session = nand_open(device_name);
 
-    static const uint16_t CrcTable[256]=
+    if(session == NULL)
     {
+        printf("failed to open %s, exit!\n", device_name);
+        exit(EXIT_FAILURE);
+    }
 
-		    0x0000, 0xC0C1, 0xC181, 0x0140, 0xC301, 0x03C0, 0x0280, 0xC241,
-		    0xC601, 0x06C0, 0x0780, 0xC741, 0x0500, 0xC5C1, 0xC481, 0x0440,
-		    0xCC01, 0x0CC0, 0x0D80, 0xCD41, 0x0F00, 0xCFC1, 0xCE81, 0x0E40,
-		    0x0A00, 0xCAC1, 0xCB81, 0x0B40, 0xC901, 0x09C0, 0x0880, 0xC841,
-		    0xD801, 0x18C0, 0x1980, 0xD941, 0x1B00, 0xDBC1, 0xDA81, 0x1A40,
-		    0x1E00, 0xDEC1, 0xDF81, 0x1F40, 0xDD01, 0x1DC0, 0x1C80, 0xDC41,
-		    0x1400, 0xD4C1, 0xD581, 0x1540, 0xD701, 0x17C0, 0x1680, 0xD641,
-		    0xD201, 0x12C0, 0x1380, 0xD341, 0x1100, 0xD1C1, 0xD081, 0x1040,
-		    0xF001, 0x30C0, 0x3180, 0xF141, 0x3300, 0xF3C1, 0xF281, 0x3240,
-		    0x3600, 0xF6C1, 0xF781, 0x3740, 0xF501, 0x35C0, 0x3480, 0xF441,
-		    0x3C00, 0xFCC1, 0xFD81, 0x3D40, 0xFF01, 0x3FC0, 0x3E80, 0xFE41,
-		    0xFA01, 0x3AC0, 0x3B80, 0xFB41, 0x3900, 0xF9C1, 0xF881, 0x3840,
-		    0x2800, 0xE8C1, 0xE981, 0x2940, 0xEB01, 0x2BC0, 0x2A80, 0xEA41,
-		    0xEE01, 0x2EC0, 0x2F80, 0xEF41, 0x2D00, 0xEDC1, 0xEC81, 0x2C40,
-		    0xE401, 0x24C0, 0x2580, 0xE541, 0x2700, 0xE7C1, 0xE681, 0x2640,
-		    0x2200, 0xE2C1, 0xE381, 0x2340, 0xE101, 0x21C0, 0x2080, 0xE041,
-		    0xA001, 0x60C0, 0x6180, 0xA141, 0x6300, 0xA3C1, 0xA281, 0x6240,
-		    0x6600, 0xA6C1, 0xA781, 0x6740, 0xA501, 0x65C0, 0x6480, 0xA441,
-		    0x6C00, 0xACC1, 0xAD81, 0x6D40, 0xAF01, 0x6FC0, 0x6E80, 0xAE41,
-		    0xAA01, 0x6AC0, 0x6B80, 0xAB41, 0x6900, 0xA9C1, 0xA881, 0x6840,
-		    0x7800, 0xB8C1, 0xB981, 0x7940, 0xBB01, 0x7BC0, 0x7A80, 0xBA41,
-		    0xBE01, 0x7EC0, 0x7F80, 0xBF41, 0x7D00, 0xBDC1, 0xBC81, 0x7C40,
-		    0xB401, 0x74C0, 0x7580, 0xB541, 0x7700, 0xB7C1, 0xB681, 0x7640,
-		    0x7200, 0xB2C1, 0xB381, 0x7340, 0xB101, 0x71C0, 0x7080, 0xB041,
-		    0x5000, 0x90C1, 0x9181, 0x5140, 0x9301, 0x53C0, 0x5280, 0x9241,
-		    0x9601, 0x56C0, 0x5780, 0x9741, 0x5500, 0x95C1, 0x9481, 0x5440,
-		    0x9C01, 0x5CC0, 0x5D80, 0x9D41, 0x5F00, 0x9FC1, 0x9E81, 0x5E40,
-		    0x5A00, 0x9AC1, 0x9B81, 0x5B40, 0x9901, 0x59C0, 0x5880, 0x9841,
-		    0x8801, 0x48C0, 0x4980, 0x8941, 0x4B00, 0x8BC1, 0x8A81, 0x4A40,
-		    0x4E00, 0x8EC1, 0x8F81, 0x4F40, 0x8D01, 0x4DC0, 0x4C80, 0x8C41,
-		    0x4400, 0x84C1, 0x8581, 0x4540, 0x8701, 0x47C0, 0x4680, 0x8641,
-		    0x8201, 0x42C0, 0x4380, 0x8341, 0x4100, 0x81C1, 0x8081, 0x4040
-
-    };
-
-    Crc    =  (int16_t )( 0xFFFF & InputCRC );
-    BufPtr = (const uint8_t *)DataPtr;
-
-    for ( i = 0 ; i < DataLength ; i++,  BufPtr++)
+    if(nand_log_open(log, session, NAND_FLASH_OFFSET, NAND_LOG_BLOCKS) < 0)
     {
-        /*
-        * It is assumed that the supplied buffer is in a
-        * directly-accessible memory space that does not
-        * require special logic to access
-        */
-        ByteValue = *BufPtr;
-        Index = ( ( Crc ^ ByteValue) & 0x00FF);
-        Crc = ( (Crc >> 8 ) & 0x00FF) ^ CrcTable[Index];
+        printf("failed to open the preserved data log, exit!\n");
+        nand_close(session);
+        exit(EXIT_FAILURE);
     }
 
-    return Crc;
+    return session;
+}
+
+/*
+ * Newest record of the log. Devices flashed before the log hold the bare
+ * structure at NAND_FLASH_OFFSET instead; while the log has no record that
+ * one is taken if its CRC matches, so the counts carry over. The first
+ * append goes to the page after it and the block is reclaimed like any
+ * other log slot later.
+ */
+static int read_preserved(nand_log_t *log, nand_session_t *session)
+{
+    GENSAT_1_cFS_preserved_data legacy;
+    int status = nand_log_read(log, ptest, sizeof(GENSAT_1_cFS_preserved_data));
+
+    if(status != 0)
+        return status;
+
+    /* the old update wrote num_launch_state 1 or more, all zeros would pass the CRC */
+    if(nand_session_dump(session, &legacy, sizeof(legacy), NAND_FLASH_OFFSET) < 0 ||
+       nand_is_erased(&legacy, sizeof(legacy)) || legacy.num_launch_state <= 0 ||
+       nand_crc16((const void *)&legacy, sizeof(int16_t)*2, 0) != legacy.crc_check)
+        return 0;
+
+    printf("preserved data in the old format, taken over into the log\n");
+    *ptest = legacy;
+    return sizeof(legacy);
 }
 
 static void process_options(int argc, char const *argv[])
@@ -235,10 +319,28 @@ static void process_options(int argc, char const *argv[])
         int option_index = 0;
         static struct option long_options[] = {
             {"t", required_argument, 0, 't'},
-            {"type", required_argument, 0, 0}
+            {"type", required_argument, 0, 0},
+            {"sim", required_argument, 0, 's'},
+            {"bbt", required_argument, 0, 'B'},
+            {"file", required_argument, 0, 'f'},
+            {"offset", required_argument, 0, 'o'},
+            {"batch", no_argument, 0, 'b'},
+            {"length", required_argument, 0, 'l'},
+            {"skip-blank", no_argument, 0, 'k'},
+            {"pipeline", no_argument, 0, 'p'},
+            {"erase", no_argument, 0, 'E'},
+            {"verify", no_argument, 0, 'V'},
+            {"delta", no_argument, 0, 'D'},
+            {"holes", no_argument, 0, 'H'},
+            {"sparse", no_argument, 0, 'Z'},
+            {"oob", required_argument, 0, 'O'},
+            {"stats", no_argument, 0, 'S'},
+            {"job", required_argument, 0, 'j'},
+            {"workers", required_argument, 0, 'w'},
+            {0, 0, 0, 0}
         };
 
-        c = getopt_long(argc, argv, "t:", long_options, &option_index);
+        c = getopt_long(argc, (char * const *)argv, "t:s:B:f:o:bl:kpEVDHZO:Sj:w:", long_options, &option_index);
 
         if(c == -1) break;
 
@@ -285,6 +387,122 @@ static void process_options(int argc, char const *argv[])
             }
             break;
         
+        case 's':
+            /* run against the file-backed simulator instead of the mtd device */
+            nand_set_dev_ops(&nand_sim_ops);
+            device_name = optarg;
+            break;
+
+        case 'B':
+            /* keep the bad block table in a file instead of rescanning every run */
+            bbt_cache = optarg;
+            nand_set_bbt_cache(optarg);
+            break;
+
+        case 'E':
+            /* erase ahead of the write instead of a separate erase pass */
+            erase_first = true;
+            break;
+
+        case 'D':
+            /* reflash: erase and program only the blocks that changed */
+            nand_flags |= NAND_F_DELTA;
+            erase_first = true;
+            break;
+
+        case 'H':
+            /* dump erased pages as file holes */
+            nand_flags |= NAND_F_DUMP_HOLES;
+            break;
+
+        case 'Z':
+            /* dump as a sparse image, write_file takes it back */
+            nand_flags |= NAND_F_DUMP_SPARSE;
+            break;
+
+        case 'V':
+            /* compare every block with the source right after programming it */
+            nand_flags |= NAND_F_VERIFY;
+            break;
+
+        case 'O':
+            /* image is page + oob records, programmed with one MEMWRITE per page */
+            if(!strcmp("raw",optarg))
+                oob_mode = MTD_OPS_RAW;
+            else if(!strcmp("auto",optarg))
+                oob_mode = MTD_OPS_AUTO_OOB;
+            else if(!strcmp("place",optarg))
+                oob_mode = MTD_OPS_PLACE_OOB;
+            else{
+                fprintf(stderr, "ERROR: \"%s\" is not among {raw|auto|place}\n", optarg);
+                run = false;
+            }
+            break;
+
+        case 'S':
+            stats = true;
+            break;
+
+        case 'j':
+            /* op:device:offset:..., may be given several times */
+            if(njobs == NAND_JOBS_MAX)
+            {
+                fprintf(stderr, "ERROR: more than %d jobs\n", NAND_JOBS_MAX);
+                run = false;
+            }
+            else if(nand_job_parse(&jobs[njobs], optarg) < 0)
+            {
+                run = false;
+            }
+            else
+            {
+                njobs++;
+            }
+            break;
+
+        case 'w':
+        {
+            char *end;
+            unsigned long val;
+
+            errno = 0;
+            val = strtoul(optarg, &end, 0);
+            if(*optarg == '\0' || *optarg == '-' || *end != '\0' || errno != 0 || val > NAND_JOBS_MAX)
+            {
+                fprintf(stderr, "ERROR: \"%s\" is not a number of workers up to %d\n", optarg, NAND_JOBS_MAX);
+                run = false;
+            }
+            nworkers = (unsigned int)val;
+            break;
+        }
+
+        case 'f':
+            image_name = optarg;
+            break;
+
+        case 'o':
+            mtd_offset = strtoull(optarg, NULL, 0);
+            break;
+
+        case 'k':
+            /* don't erase blank blocks, don't program all 0xFF pages */
+            nand_flags |= NAND_F_SKIP_BLANK | NAND_F_SKIP_FF;
+            break;
+
+        case 'p':
+            /* read the image on its own thread while the flash programs */
+            nand_flags |= NAND_F_PIPELINE;
+            break;
+
+        case 'l':
+            image_len = strtoll(optarg, NULL, 0);
+            break;
+
+        case 'b':
+            /* one read and one pwrite per eraseblock */
+            nand_flags |= NAND_F_BATCH;
+            break;
+
         default:
             printf("?? getopt returned character code 0%o ??\n", c);
             break;
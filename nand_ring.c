@@ -0,0 +1,114 @@
+#include "nand_ring.h"
+
+int nand_ring_init(nand_ring_t *r, unsigned int nbufs, size_t bufsize)
+{
+    unsigned int i;
+    long align = sysconf(_SC_PAGESIZE);
+
+    if (align <= 0)
+        align = 4096;
+
+    memset(r, 0, sizeof(*r));
+    r->bufs = (uint8_t **)calloc(nbufs, sizeof(uint8_t *));
+    r->lens = (size_t *)calloc(nbufs, sizeof(size_t));
+    if (r->bufs == NULL || r->lens == NULL)
+        goto fail;
+
+    r->nbufs = nbufs;
+    r->bufsize = bufsize;
+    for (i = 0; i < nbufs; i++) {
+        if (posix_memalign((void **)&r->bufs[i], align, bufsize) != 0) {
+            r->bufs[i] = NULL;
+            goto fail;
+        }
+    }
+
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_cond_init(&r->cond, NULL);
+    return 0;
+
+fail:
+    nand_msg("malloc %u x %zu ring buffers failed!\n", nbufs, bufsize);
+    if (r->bufs) {
+        for (i = 0; i < nbufs; i++)
+            free(r->bufs[i]);
+    }
+    free(r->bufs);
+    free(r->lens);
+    memset(r, 0, sizeof(*r));
+    return -1;
+}
+
+void nand_ring_destroy(nand_ring_t *r)
+{
+    unsigned int i;
+
+    for (i = 0; i < r->nbufs; i++)
+        free(r->bufs[i]);
+    free(r->bufs);
+    free(r->lens);
+    pthread_mutex_destroy(&r->lock);
+    pthread_cond_destroy(&r->cond);
+    memset(r, 0, sizeof(*r));
+}
+
+uint8_t *nand_ring_get_free(nand_ring_t *r)
+{
+    uint8_t *buf = NULL;
+
+    pthread_mutex_lock(&r->lock);
+    while (!r->aborted && r->committed - r->released == r->nbufs)
+        pthread_cond_wait(&r->cond, &r->lock);
+    if (!r->aborted)
+        buf = r->bufs[r->committed % r->nbufs];
+    pthread_mutex_unlock(&r->lock);
+    return buf;
+}
+
+void nand_ring_put(nand_ring_t *r, size_t len)
+{
+    pthread_mutex_lock(&r->lock);
+    r->lens[r->committed % r->nbufs] = len;
+    r->committed++;
+    pthread_cond_broadcast(&r->cond);
+    pthread_mutex_unlock(&r->lock);
+}
+
+void nand_ring_close(nand_ring_t *r)
+{
+    pthread_mutex_lock(&r->lock);
+    r->closed = true;
+    pthread_cond_broadcast(&r->cond);
+    pthread_mutex_unlock(&r->lock);
+}
+
+uint8_t *nand_ring_get_full(nand_ring_t *r, size_t *len)
+{
+    uint8_t *buf = NULL;
+
+    pthread_mutex_lock(&r->lock);
+    while (!r->aborted && !r->closed && r->released == r->committed)
+        pthread_cond_wait(&r->cond, &r->lock);
+    if (!r->aborted && r->released != r->committed) {
+        buf = r->bufs[r->released % r->nbufs];
+        *len = r->lens[r->released % r->nbufs];
+    }
+    pthread_mutex_unlock(&r->lock);
+    return buf;
+}
+
+void nand_ring_release(nand_ring_t *r)
+{
+    pthread_mutex_lock(&r->lock);
+    r->released++;
+    pthread_cond_broadcast(&r->cond);
+    pthread_mutex_unlock(&r->lock);
+}
+
+void nand_ring_abort(nand_ring_t *r)
+{
+    pthread_mutex_lock(&r->lock);
+    r->aborted = true;
+    pthread_cond_broadcast(&r->cond);
+    pthread_mutex_unlock(&r->lock);
+}
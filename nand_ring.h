@@ -0,0 +1,49 @@
+#ifndef NAND_RING_H
+#define NAND_RING_H
+
+#include <pthread.h>
+#include "nand.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Bounded ring of memory page aligned buffers between one producer and one
+ * consumer thread. The producer fills the slot returned by nand_ring_get_free
+ * and hands it over with nand_ring_put, the consumer gets it back with
+ * nand_ring_get_full and frees it with nand_ring_release.
+ */
+typedef struct nand_ring
+{
+    uint8_t         **bufs;
+    size_t          *lens;                  /* bytes valid in each slot */
+    unsigned int    nbufs;
+    size_t          bufsize;
+    unsigned int    committed;              /* slots handed to the consumer */
+    unsigned int    released;               /* slots handed back to the producer */
+    bool            closed;                 /* producer is done */
+    bool            aborted;                /* either side failed, both sides stop */
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+}nand_ring_t;
+
+int nand_ring_init(nand_ring_t *r, unsigned int nbufs, size_t bufsize);
+void nand_ring_destroy(nand_ring_t *r);
+
+/* producer side, get_free returns NULL once the ring is aborted */
+uint8_t *nand_ring_get_free(nand_ring_t *r);
+void nand_ring_put(nand_ring_t *r, size_t len);
+void nand_ring_close(nand_ring_t *r);
+
+/* consumer side, get_full returns NULL when closed and drained, or aborted */
+uint8_t *nand_ring_get_full(nand_ring_t *r, size_t *len);
+void nand_ring_release(nand_ring_t *r);
+
+void nand_ring_abort(nand_ring_t *r);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,638 @@
+#include <limits.h>
+#include <pthread.h>
+#include "nand_sim.h"
+
+/*
+ * File-backed NAND simulator.
+ *
+ * The backing file holds the main area of the whole device, the OOB lives in
+ * a "<backing file>.oob" sidecar with oobsize bytes per page. Erase sets a
+ * block to 0xFF, program can only clear bits (new = old & data), writes must
+ * be page aligned and whole pages, like a real mtdchar NAND device. There is
+ * no ECC: the first SIM_OOB_RESERVED OOB bytes of a page are kept for the bad
+ * block marker, the rest is free for MTD_OPS_AUTO_OOB.
+ */
+
+#define SIM_OOB_RESERVED    2
+
+struct nand_sim_dev
+{
+    int         fd;                         /* backing file, -1 when the slot is free */
+    int         oob_fd;                     /* oob sidecar, -1 if there is none (reads 0xFF) */
+    uint64_t    size;
+    uint32_t    erasesize;
+    uint32_t    writesize;
+    uint32_t    oobsize;
+    uint8_t     *bad;                       /* one byte per eraseblock, 1 => bad */
+    uint8_t     *page;                      /* read-modify-write buffer for program */
+    uint8_t     *oob;                       /* same for the oob of a page */
+    uint32_t    read_page_us;
+    uint32_t    program_page_us;
+    uint32_t    erase_block_us;
+    uint32_t    badblock_check_us;
+};
+
+static nand_sim_config_t sim_config = {
+    .size       = 16 * 1024 * 1024,
+    .erasesize  = 128 * 1024,
+    .writesize  = 2048,
+    .oobsize    = 64,
+};
+static uint32_t *sim_bad_blocks = NULL;
+
+static struct nand_sim_dev sim_devs[NAND_SIM_MAX_DEVS] = {
+    [0 ... NAND_SIM_MAX_DEVS - 1] = { .fd = -1, .oob_fd = -1 }
+};
+
+/* guards sim_config and the slots, devices may be opened from several threads */
+static pthread_mutex_t sim_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+void nand_sim_default_config(nand_sim_config_t *cfg)
+{
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->size       = 16 * 1024 * 1024;
+    cfg->erasesize  = 128 * 1024;
+    cfg->writesize  = 2048;
+    cfg->oobsize    = 64;
+}
+
+void nand_sim_set_config(const nand_sim_config_t *cfg)
+{
+    pthread_mutex_lock(&sim_lock);
+    free(sim_bad_blocks);
+    sim_bad_blocks = NULL;
+
+    sim_config = *cfg;
+    if (cfg->num_bad_blocks) {
+        sim_bad_blocks = (uint32_t *)malloc(cfg->num_bad_blocks * sizeof(uint32_t));
+        if (sim_bad_blocks == NULL) {
+            nand_msg("nand_sim: malloc bad block list failed!\n");
+            sim_config.num_bad_blocks = 0;
+        } else {
+            memcpy(sim_bad_blocks, cfg->bad_blocks, cfg->num_bad_blocks * sizeof(uint32_t));
+        }
+    }
+    sim_config.bad_blocks = sim_bad_blocks;
+    pthread_mutex_unlock(&sim_lock);
+}
+
+
+/* called with sim_lock held */
+static struct nand_sim_dev *sim_find(int fd)
+{
+    int i;
+
+    for (i = 0; i < NAND_SIM_MAX_DEVS; i++) {
+        if (sim_devs[i].fd >= 0 && sim_devs[i].fd == fd)
+            return &sim_devs[i];
+    }
+    errno = EBADF;
+    return NULL;
+}
+
+static struct nand_sim_dev *sim_lookup(int fd)
+{
+    struct nand_sim_dev *dev;
+
+    pthread_mutex_lock(&sim_lock);
+    dev = sim_find(fd);
+    pthread_mutex_unlock(&sim_lock);
+    return dev;
+}
+
+/* model the chip busy time of an operation */
+static void sim_delay(uint32_t us)
+{
+    struct timespec ts;
+
+    if (us == 0)
+        return;
+    ts.tv_sec = us / 1000000;
+    ts.tv_nsec = (long)(us % 1000000) * 1000;
+    while (nanosleep(&ts, &ts) < 0 && errno == EINTR)
+        ;
+}
+
+static int sim_fill_erased(int fd, off_t start, uint64_t len)
+{
+    uint8_t ff[4096];
+    ssize_t size;
+
+    memset(ff, 0xFF, sizeof(ff));
+    while (len > 0) {
+        size_t chunk = len < sizeof(ff) ? (size_t)len : sizeof(ff);
+
+        size = pwrite(fd, ff, chunk, start);
+        if (size != (ssize_t)chunk)
+            return -1;
+        start += chunk;
+        len -= chunk;
+    }
+    return 0;
+}
+
+/* open or create the oob sidecar, a missing one is fine for read only opens */
+static int sim_open_oob(struct nand_sim_dev *dev, const char *device_name, int flags)
+{
+    char path[PATH_MAX];
+    off_t oob_total = (off_t)(dev->size / dev->writesize * dev->oobsize);
+    struct stat st;
+
+    dev->oob_fd = -1;
+    if (dev->oobsize == 0)
+        return 0;
+    if (snprintf(path, sizeof(path), "%s.oob", device_name) >= (int)sizeof(path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    if ((flags & O_ACCMODE) == O_RDONLY) {
+        dev->oob_fd = open(path, O_RDONLY);
+        return dev->oob_fd < 0 && errno != ENOENT ? -1 : 0;
+    }
+
+    dev->oob_fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (dev->oob_fd < 0 || fstat(dev->oob_fd, &st) < 0)
+        goto fail;
+    if (st.st_size < oob_total &&
+        (ftruncate(dev->oob_fd, oob_total) < 0 ||
+         sim_fill_erased(dev->oob_fd, st.st_size, oob_total - st.st_size) < 0))
+        goto fail;
+    return 0;
+
+fail:
+    if (dev->oob_fd >= 0)
+        close(dev->oob_fd);
+    dev->oob_fd = -1;
+    return -1;
+}
+
+static int sim_open_locked(const char *device_name, int flags)
+{
+    struct nand_sim_dev *dev = NULL;
+    struct stat st;
+    uint32_t i;
+
+    if (sim_config.writesize == 0 || (sim_config.writesize & (sim_config.writesize - 1)) ||
+        sim_config.erasesize % sim_config.writesize ||
+        (sim_config.erasesize & (sim_config.erasesize - 1))) {
+        nand_msg("nand_sim: bad geometry, page %u, block %u\n", sim_config.writesize, sim_config.erasesize);
+        errno = EINVAL;
+        return -1;
+    }
+
+    for (i = 0; i < NAND_SIM_MAX_DEVS; i++) {
+        if (sim_devs[i].fd < 0) {
+            dev = &sim_devs[i];
+            break;
+        }
+    }
+    if (dev == NULL) {
+        errno = EMFILE;
+        return -1;
+    }
+
+    int fd = open(device_name, (flags & O_ACCMODE) == O_RDONLY ? O_RDONLY : O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+        return -1;
+
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    /* a new backing file starts out fully erased */
+    if (st.st_size == 0) {
+        if (ftruncate(fd, sim_config.size) < 0 || sim_fill_erased(fd, 0, sim_config.size) < 0) {
+            nand_msg("nand_sim: init %s failed!\n", device_name);
+            close(fd);
+            return -1;
+        }
+        st.st_size = sim_config.size;
+    }
+
+    if (st.st_size % sim_config.erasesize) {
+        nand_msg("nand_sim: %s size %lld is not a multiple of eraseblock size\n",
+                 device_name, (long long)st.st_size);
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+
+    dev->size               = (uint64_t)st.st_size;
+    dev->erasesize          = sim_config.erasesize;
+    dev->writesize          = sim_config.writesize;
+    dev->oobsize            = sim_config.oobsize;
+    dev->read_page_us       = sim_config.read_page_us;
+    dev->program_page_us    = sim_config.program_page_us;
+    dev->erase_block_us     = sim_config.erase_block_us;
+    dev->badblock_check_us  = sim_config.badblock_check_us;
+
+    dev->bad = (uint8_t *)calloc(dev->size / dev->erasesize, 1);
+    dev->page = (uint8_t *)malloc(dev->writesize);
+    dev->oob = (uint8_t *)malloc(dev->oobsize ? dev->oobsize : 1);
+    if (dev->bad == NULL || dev->page == NULL || dev->oob == NULL) {
+        free(dev->bad);
+        free(dev->page);
+        free(dev->oob);
+        close(fd);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    if (sim_open_oob(dev, device_name, flags) < 0) {
+        nand_msg("nand_sim: init %s.oob failed!\n", device_name);
+        free(dev->bad);
+        free(dev->page);
+        free(dev->oob);
+        close(fd);
+        return -1;
+    }
+
+    for (i = 0; i < sim_config.num_bad_blocks; i++) {
+        if (sim_config.bad_blocks[i] < dev->size / dev->erasesize)
+            dev->bad[sim_config.bad_blocks[i]] = 1;
+    }
+
+    dev->fd = fd;
+    return fd;
+}
+
+static int sim_open(const char *device_name, int flags)
+{
+    int fd;
+
+    pthread_mutex_lock(&sim_lock);
+    fd = sim_open_locked(device_name, flags);
+    pthread_mutex_unlock(&sim_lock);
+    return fd;
+}
+
+static int sim_close(int fd)
+{
+    struct nand_sim_dev *dev;
+
+    pthread_mutex_lock(&sim_lock);
+    dev = sim_find(fd);
+    if (dev == NULL) {
+        pthread_mutex_unlock(&sim_lock);
+        return -1;
+    }
+
+    free(dev->bad);
+    free(dev->page);
+    free(dev->oob);
+    if (dev->oob_fd >= 0)
+        close(dev->oob_fd);
+    dev->bad = NULL;
+    dev->page = NULL;
+    dev->oob = NULL;
+    dev->oob_fd = -1;
+    dev->fd = -1;
+    pthread_mutex_unlock(&sim_lock);
+    return close(fd);
+}
+
+static int sim_fstat(int fd, struct stat *st)
+{
+    if (sim_lookup(fd) == NULL)
+        return -1;
+    if (fstat(fd, st) < 0)
+        return -1;
+
+    /* look like an mtd char device to the callers */
+    st->st_mode = (st->st_mode & ~S_IFMT) | S_IFCHR;
+    return 0;
+}
+
+static int sim_xfer_oob(struct nand_sim_dev *dev, uint64_t start, uint64_t len, uint64_t ooblen,
+                        uint8_t *data, uint8_t *oob, int mode, bool write);
+
+static int sim_erase(struct nand_sim_dev *dev, uint64_t start, uint64_t len)
+{
+    uint64_t end = start + len;
+
+    if ((start % dev->erasesize) || (len % dev->erasesize) || end < start || end > dev->size) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    for (; start < end; start += dev->erasesize) {
+        sim_delay(dev->erase_block_us);
+        if (dev->bad[start / dev->erasesize]) {
+            errno = EIO;
+            return -1;
+        }
+        if (sim_fill_erased(dev->fd, (off_t)start, dev->erasesize) < 0)
+            return -1;
+        if (dev->oob_fd >= 0 &&
+            sim_fill_erased(dev->oob_fd, (off_t)(start / dev->writesize * dev->oobsize),
+                            dev->erasesize / dev->writesize * dev->oobsize) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+static int sim_ioctl(int fd, unsigned long request, void *arg)
+{
+    struct nand_sim_dev *dev = sim_lookup(fd);
+
+    if (dev == NULL)
+        return -1;
+
+    switch (request) {
+    case MEMGETINFO: {
+        mtd_info_t *meminfo = (mtd_info_t *)arg;
+
+        memset(meminfo, 0, sizeof(*meminfo));
+        meminfo->type       = MTD_NANDFLASH;
+        meminfo->flags      = MTD_CAP_NANDFLASH;
+        meminfo->size       = (uint32_t)dev->size;    /* truncated past 4GiB, like mtdchar */
+        meminfo->erasesize  = dev->erasesize;
+        meminfo->writesize  = dev->writesize;
+        meminfo->oobsize    = dev->oobsize;
+        return 0;
+    }
+
+    case MEMGETBADBLOCK: {
+        loff_t offs = *(loff_t *)arg;
+
+        sim_delay(dev->badblock_check_us);
+        if (offs < 0 || (uint64_t)offs >= dev->size) {
+            errno = EINVAL;
+            return -1;
+        }
+        return dev->bad[offs / dev->erasesize];
+    }
+
+    case MEMSETBADBLOCK: {
+        loff_t offs = *(loff_t *)arg;
+
+        if (offs < 0 || (uint64_t)offs >= dev->size) {
+            errno = EINVAL;
+            return -1;
+        }
+        dev->bad[offs / dev->erasesize] = 1;
+        return 0;
+    }
+
+    case MEMERASE: {
+        erase_info_t *erase = (erase_info_t *)arg;
+
+        return sim_erase(dev, erase->start, erase->length);
+    }
+
+    case MEMERASE64: {
+        struct erase_info_user64 *erase = (struct erase_info_user64 *)arg;
+
+        return sim_erase(dev, erase->start, erase->length);
+    }
+
+    case ECCGETLAYOUT: {
+        struct nand_ecclayout_user *layout = (struct nand_ecclayout_user *)arg;
+
+        memset(layout, 0, sizeof(*layout));
+        if (dev->oobsize > SIM_OOB_RESERVED) {
+            layout->oobavail = dev->oobsize - SIM_OOB_RESERVED;
+            layout->oobfree[0].offset = SIM_OOB_RESERVED;
+            layout->oobfree[0].length = layout->oobavail;
+        }
+        return 0;
+    }
+
+    case MEMWRITE: {
+        struct mtd_write_req *req = (struct mtd_write_req *)arg;
+
+        return sim_xfer_oob(dev, req->start, req->len, req->ooblen, (uint8_t *)(uintptr_t)req->usr_data,
+                            (uint8_t *)(uintptr_t)req->usr_oob, req->mode, true);
+    }
+
+    case MEMREAD: {
+        struct mtd_read_req *req = (struct mtd_read_req *)arg;
+
+        memset(&req->ecc_stats, 0, sizeof(req->ecc_stats));
+        return sim_xfer_oob(dev, req->start, req->len, req->ooblen, (uint8_t *)(uintptr_t)req->usr_data,
+                            (uint8_t *)(uintptr_t)req->usr_oob, req->mode, false);
+    }
+
+    default:
+        errno = ENOTTY;
+        return -1;
+    }
+}
+
+static off_t sim_lseek(int fd, off_t offset, int whence)
+{
+    if (sim_lookup(fd) == NULL)
+        return -1;
+    return lseek(fd, offset, whence);
+}
+
+/* read at pos, returns bytes read */
+static ssize_t sim_fetch(struct nand_sim_dev *dev, void *buf, size_t count, off_t pos)
+{
+    size_t pages;
+
+    if (pos < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    if ((uint64_t)pos >= dev->size)
+        return 0;
+    if (count > dev->size - pos)
+        count = dev->size - pos;
+
+    /* every page touched costs a page read */
+    pages = (pos + count + dev->writesize - 1) / dev->writesize - pos / dev->writesize;
+    sim_delay(pages * dev->read_page_us);
+
+    return pread(dev->fd, buf, count, pos);
+}
+
+static ssize_t sim_read(int fd, void *buf, size_t count)
+{
+    struct nand_sim_dev *dev = sim_lookup(fd);
+    off_t pos;
+    ssize_t done;
+
+    if (dev == NULL)
+        return -1;
+
+    pos = lseek(fd, 0, SEEK_CUR);
+    if (pos < 0)
+        return -1;
+
+    done = sim_fetch(dev, buf, count, pos);
+    if (done > 0)
+        lseek(fd, pos + done, SEEK_SET);
+    return done;
+}
+
+static ssize_t sim_pread(int fd, void *buf, size_t count, off_t offset)
+{
+    struct nand_sim_dev *dev = sim_lookup(fd);
+
+    if (dev == NULL)
+        return -1;
+    if (offset < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    return sim_fetch(dev, buf, count, offset);
+}
+
+/* program whole pages at pos, returns bytes programmed */
+static ssize_t sim_program(struct nand_sim_dev *dev, const void *buf, size_t count, off_t pos)
+{
+    const uint8_t *data = (const uint8_t *)buf;
+    size_t done;
+    uint32_t i;
+
+    if (pos < 0 || (pos % dev->writesize) || (count % dev->writesize)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if ((uint64_t)pos >= dev->size) {
+        errno = ENOSPC;
+        return -1;
+    }
+    if (count > dev->size - pos)
+        count = dev->size - pos;
+
+    for (done = 0; done < count; done += dev->writesize) {
+        off_t page_pos = pos + done;
+
+        sim_delay(dev->program_page_us);
+        if (dev->bad[page_pos / dev->erasesize]) {
+            errno = EIO;
+            break;
+        }
+
+        /* program can only pull bits from 1 to 0 */
+        if (pread(dev->fd, dev->page, dev->writesize, page_pos) != (ssize_t)dev->writesize)
+            break;
+        for (i = 0; i < dev->writesize; i++)
+            dev->page[i] &= data[done + i];
+        if (pwrite(dev->fd, dev->page, dev->writesize, page_pos) != (ssize_t)dev->writesize)
+            break;
+    }
+
+    if (done == 0 && count > 0)
+        return -1;
+    return done;
+}
+
+static ssize_t sim_write(int fd, const void *buf, size_t count)
+{
+    struct nand_sim_dev *dev = sim_lookup(fd);
+    off_t pos;
+    ssize_t done;
+
+    if (dev == NULL)
+        return -1;
+
+    pos = lseek(fd, 0, SEEK_CUR);
+    if (pos < 0)
+        return -1;
+
+    done = sim_program(dev, buf, count, pos);
+    if (done > 0)
+        lseek(fd, pos + done, SEEK_SET);
+    return done;
+}
+
+static ssize_t sim_pwrite(int fd, const void *buf, size_t count, off_t offset)
+{
+    struct nand_sim_dev *dev = sim_lookup(fd);
+
+    if (dev == NULL)
+        return -1;
+    return sim_program(dev, buf, count, offset);
+}
+
+/*
+ * MEMWRITE/MEMREAD: main area and oob of whole pages in one call. Raw and
+ * place mode put the oob at byte 0 of each page, auto only fills the free
+ * bytes after SIM_OOB_RESERVED. Oob only requests leave the main area alone.
+ */
+static int sim_xfer_oob(struct nand_sim_dev *dev, uint64_t start, uint64_t len, uint64_t ooblen,
+                        uint8_t *data, uint8_t *oob, int mode, bool write)
+{
+    uint32_t first = mode == MTD_OPS_AUTO_OOB ? SIM_OOB_RESERVED : 0;
+    uint32_t per_page = dev->oobsize > first ? dev->oobsize - first : 0;
+    uint64_t pages, chunk;
+    off_t pos;
+    uint32_t i;
+
+    if (data == NULL)
+        len = 0;
+    if (oob == NULL)
+        ooblen = 0;
+    if ((mode != MTD_OPS_PLACE_OOB && mode != MTD_OPS_AUTO_OOB && mode != MTD_OPS_RAW) ||
+        (data == NULL && oob == NULL) || (start % dev->writesize) || (len % dev->writesize) ||
+        (ooblen > 0 && per_page == 0)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    pages = data != NULL ? len / dev->writesize : (ooblen + per_page - 1) / per_page;
+    if (ooblen > pages * per_page || start + pages * dev->writesize > dev->size) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (data != NULL) {
+        ssize_t done = write ? sim_program(dev, data, len, start) : sim_fetch(dev, data, len, start);
+
+        if (done != (ssize_t)len) {
+            if (done >= 0)
+                errno = EIO;
+            return -1;
+        }
+    }
+
+    for (pos = start; ooblen > 0; pos += dev->writesize) {
+        off_t oob_pos = pos / dev->writesize * dev->oobsize + first;
+
+        chunk = ooblen < per_page ? ooblen : per_page;
+        if (!write) {
+            if (dev->oob_fd < 0)
+                memset(oob, 0xFF, chunk);
+            else if (pread(dev->oob_fd, oob, chunk, oob_pos) != (ssize_t)chunk)
+                return -1;
+        } else {
+            if (dev->oob_fd < 0) {
+                errno = EROFS;
+                return -1;
+            }
+            if (dev->bad[pos / dev->erasesize]) {
+                errno = EIO;
+                return -1;
+            }
+
+            /* program can only pull bits from 1 to 0, same as the main area */
+            if (pread(dev->oob_fd, dev->oob, chunk, oob_pos) != (ssize_t)chunk)
+                return -1;
+            for (i = 0; i < chunk; i++)
+                dev->oob[i] &= oob[i];
+            if (pwrite(dev->oob_fd, dev->oob, chunk, oob_pos) != (ssize_t)chunk)
+                return -1;
+        }
+        oob += chunk;
+        ooblen -= chunk;
+    }
+    return 0;
+}
+
+const nand_dev_ops_t nand_sim_ops = {
+    .open   = sim_open,
+    .close  = sim_close,
+    .fstat  = sim_fstat,
+    .ioctl  = sim_ioctl,
+    .lseek  = sim_lseek,
+    .read   = sim_read,
+    .write  = sim_write,
+    .pread  = sim_pread,
+    .pwrite = sim_pwrite,
+};
@@ -0,0 +1,40 @@
+#ifndef NAND_SIM_H
+#define NAND_SIM_H
+
+#include "nand.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* max simulated devices open at the same time */
+#define NAND_SIM_MAX_DEVS       8
+
+/* Geometry and timing of the file-backed NAND simulator */
+typedef struct nand_sim_config
+{
+    uint64_t        size;                   /* device size, used when the backing file is created */
+    uint32_t        erasesize;              /* eraseblock size */
+    uint32_t        writesize;              /* page size */
+    uint32_t        oobsize;                /* oob bytes per page, kept in <backing file>.oob */
+    const uint32_t  *bad_blocks;            /* factory-bad eraseblock indices */
+    uint32_t        num_bad_blocks;
+    uint32_t        read_page_us;           /* latency per page read */
+    uint32_t        program_page_us;        /* latency per page program */
+    uint32_t        erase_block_us;         /* latency per eraseblock erase */
+    uint32_t        badblock_check_us;      /* latency per MEMGETBADBLOCK */
+}nand_sim_config_t;
+
+/* simulator ops, pass to nand_set_dev_ops() and use the backing file path as device name */
+extern const nand_dev_ops_t nand_sim_ops;
+
+/* fill cfg with a small SLC part: 16MiB, 128KiB blocks, 2KiB pages, no latency */
+void nand_sim_default_config(nand_sim_config_t *cfg);
+/* geometry used for devices opened from now on, the bad block list is copied */
+void nand_sim_set_config(const nand_sim_config_t *cfg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
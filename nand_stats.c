@@ -0,0 +1,229 @@
+#include <inttypes.h>
+#include <pthread.h>
+#include "nand_stats.h"
+
+static const nand_dev_ops_t *inner = &nand_mtd_ops;
+
+static nand_stat_t stats[NAND_STAT_OPS];
+static uint64_t syscalls;
+/* a few instructions under the lock per syscall, never contended for long */
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char *const stat_names[NAND_STAT_OPS] = {
+    [NAND_STAT_ERASE]       = "erase",
+    [NAND_STAT_PROGRAM]     = "program",
+    [NAND_STAT_READ]        = "read",
+    [NAND_STAT_BADBLOCK]    = "badblock",
+};
+
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static unsigned int bucket(uint64_t ns)
+{
+    uint64_t us = ns / 1000;
+    unsigned int b = us ? 64 - __builtin_clzll(us) : 0;
+
+    return b < NAND_STATS_BUCKETS ? b : NAND_STATS_BUCKETS - 1;
+}
+
+/* op < 0 only counts the syscall */
+static void account(int op, uint64_t start, int64_t ret, uint64_t bytes)
+{
+    uint64_t ns = now_ns() - start;
+    nand_stat_t *st;
+
+    pthread_mutex_lock(&stats_lock);
+    syscalls++;
+    if (op >= 0) {
+        st = &stats[op];
+        st->calls++;
+        if (ret < 0)
+            st->errors++;
+        else
+            st->bytes += bytes;
+        st->total_ns += ns;
+        if (ns > st->max_ns)
+            st->max_ns = ns;
+        st->hist[bucket(ns)]++;
+    }
+    pthread_mutex_unlock(&stats_lock);
+}
+
+
+static int stats_open(const char *device_name, int flags)
+{
+    uint64_t start = now_ns();
+    int ret = inner->open(device_name, flags);
+
+    account(-1, start, ret, 0);
+    return ret;
+}
+
+static int stats_close(int fd)
+{
+    uint64_t start = now_ns();
+    int ret = inner->close(fd);
+
+    account(-1, start, ret, 0);
+    return ret;
+}
+
+static int stats_fstat(int fd, struct stat *st)
+{
+    uint64_t start = now_ns();
+    int ret = inner->fstat(fd, st);
+
+    account(-1, start, ret, 0);
+    return ret;
+}
+
+static int stats_ioctl(int fd, unsigned long request, void *arg)
+{
+    uint64_t start = now_ns();
+    int ret = inner->ioctl(fd, request, arg);
+
+    switch (request) {
+    case MEMERASE:
+        account(NAND_STAT_ERASE, start, ret, ((erase_info_t *)arg)->length);
+        break;
+    case MEMERASE64:
+        account(NAND_STAT_ERASE, start, ret, ((struct erase_info_user64 *)arg)->length);
+        break;
+    case MEMGETBADBLOCK:
+        account(NAND_STAT_BADBLOCK, start, ret, 0);
+        break;
+    case MEMWRITE:
+        account(NAND_STAT_PROGRAM, start, ret,
+                ((struct mtd_write_req *)arg)->len + ((struct mtd_write_req *)arg)->ooblen);
+        break;
+    case MEMREAD:
+        account(NAND_STAT_READ, start, ret,
+                ((struct mtd_read_req *)arg)->len + ((struct mtd_read_req *)arg)->ooblen);
+        break;
+    default:
+        account(-1, start, ret, 0);
+        break;
+    }
+    return ret;
+}
+
+static off_t stats_lseek(int fd, off_t offset, int whence)
+{
+    uint64_t start = now_ns();
+    off_t ret = inner->lseek(fd, offset, whence);
+
+    account(-1, start, ret, 0);
+    return ret;
+}
+
+static ssize_t stats_read(int fd, void *buf, size_t count)
+{
+    uint64_t start = now_ns();
+    ssize_t ret = inner->read(fd, buf, count);
+
+    account(NAND_STAT_READ, start, ret, ret);
+    return ret;
+}
+
+static ssize_t stats_write(int fd, const void *buf, size_t count)
+{
+    uint64_t start = now_ns();
+    ssize_t ret = inner->write(fd, buf, count);
+
+    account(NAND_STAT_PROGRAM, start, ret, ret);
+    return ret;
+}
+
+static ssize_t stats_pread(int fd, void *buf, size_t count, off_t offset)
+{
+    uint64_t start = now_ns();
+    ssize_t ret = inner->pread(fd, buf, count, offset);
+
+    account(NAND_STAT_READ, start, ret, ret);
+    return ret;
+}
+
+static ssize_t stats_pwrite(int fd, const void *buf, size_t count, off_t offset)
+{
+    uint64_t start = now_ns();
+    ssize_t ret = inner->pwrite(fd, buf, count, offset);
+
+    account(NAND_STAT_PROGRAM, start, ret, ret);
+    return ret;
+}
+
+static const nand_dev_ops_t stats_ops = {
+    .open   = stats_open,
+    .close  = stats_close,
+    .fstat  = stats_fstat,
+    .ioctl  = stats_ioctl,
+    .lseek  = stats_lseek,
+    .read   = stats_read,
+    .write  = stats_write,
+    .pread  = stats_pread,
+    .pwrite = stats_pwrite,
+};
+
+const nand_dev_ops_t *nand_stats_wrap(const nand_dev_ops_t *ops)
+{
+    if (ops != &stats_ops)
+        inner = ops;
+    return &stats_ops;
+}
+
+void nand_stats_reset(void)
+{
+    pthread_mutex_lock(&stats_lock);
+    memset(stats, 0, sizeof(stats));
+    syscalls = 0;
+    pthread_mutex_unlock(&stats_lock);
+}
+
+void nand_stats_get(nand_stat_t out[NAND_STAT_OPS], uint64_t *nsyscalls)
+{
+    pthread_mutex_lock(&stats_lock);
+    memcpy(out, stats, sizeof(stats));
+    if (nsyscalls != NULL)
+        *nsyscalls = syscalls;
+    pthread_mutex_unlock(&stats_lock);
+}
+
+void nand_stats_report(FILE *out)
+{
+    nand_stat_t snap[NAND_STAT_OPS];
+    uint64_t nsyscalls;
+    unsigned int op, b;
+    bool first;
+
+    nand_stats_get(snap, &nsyscalls);
+
+    fprintf(out, "{\"syscalls\":%" PRIu64 ",\"ops\":{", nsyscalls);
+    for (op = 0; op < NAND_STAT_OPS; op++) {
+        nand_stat_t *st = &snap[op];
+
+        fprintf(out, "%s\"%s\":{\"calls\":%" PRIu64 ",\"errors\":%" PRIu64 ",\"bytes\":%" PRIu64
+                ",\"total_us\":%" PRIu64 ",\"max_us\":%" PRIu64 ",\"hist_us\":{",
+                op ? "," : "", stat_names[op], st->calls, st->errors, st->bytes,
+                st->total_ns / 1000, st->max_ns / 1000);
+
+        /* keyed by the lower bound of the bucket, empty buckets left out */
+        first = true;
+        for (b = 0; b < NAND_STATS_BUCKETS; b++) {
+            if (st->hist[b] == 0)
+                continue;
+            fprintf(out, "%s\"%" PRIu64 "\":%" PRIu64, first ? "" : ",",
+                    b ? (uint64_t)1 << (b - 1) : 0, st->hist[b]);
+            first = false;
+        }
+        fprintf(out, "}}");
+    }
+    fprintf(out, "}}\n");
+    fflush(out);
+}
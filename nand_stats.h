@@ -0,0 +1,52 @@
+#ifndef NAND_STATS_H
+#define NAND_STATS_H
+
+#include "nand.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Call counters and latency histograms of the device operations. The ops
+ * returned by nand_stats_wrap time every call into the wrapped ops with the
+ * monotonic clock, install them with nand_set_dev_ops() before opening
+ * sessions. Counters are shared by every session and thread.
+ */
+
+/* log2 latency buckets: 0 is < 1us, bucket i >= 1 is [2^(i-1), 2^i) us, the last one is open */
+#define NAND_STATS_BUCKETS  24
+
+typedef enum nand_stat_op
+{
+    NAND_STAT_ERASE,                        /* MEMERASE, MEMERASE64 */
+    NAND_STAT_PROGRAM,                      /* write, pwrite, MEMWRITE */
+    NAND_STAT_READ,                         /* read, pread, MEMREAD */
+    NAND_STAT_BADBLOCK,                     /* MEMGETBADBLOCK */
+    NAND_STAT_OPS
+}nand_stat_op_t;
+
+typedef struct nand_stat
+{
+    uint64_t    calls;
+    uint64_t    errors;                     /* calls that returned < 0 */
+    uint64_t    bytes;                      /* erased, programmed or read by calls that succeeded */
+    uint64_t    total_ns;
+    uint64_t    max_ns;
+    uint64_t    hist[NAND_STATS_BUCKETS];
+}nand_stat_t;
+
+/* ops that count and time every call, then pass it on to ops */
+const nand_dev_ops_t *nand_stats_wrap(const nand_dev_ops_t *ops);
+
+void nand_stats_reset(void);
+/* consistent copy of the counters, syscalls counts every call through the wrapper */
+void nand_stats_get(nand_stat_t stats[NAND_STAT_OPS], uint64_t *syscalls);
+/* the counters as one line of JSON */
+void nand_stats_report(FILE *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,384 @@
+#define _GNU_SOURCE
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "nand.h"
+#include "nand_sim.h"
+#include "nand_log.h"
+#include "nand_stats.h"
+#include "nandd.h"
+
+/*
+ * Preserved data daemon, see nandd.h for the request API.
+ *
+ * One thread, one poll loop over the listening socket and the clients. The
+ * session, its bad block table and the log stay open for the life of the
+ * daemon, so an update costs no device open, no rescan and no erase on its
+ * path. The first update after a flush starts the window, everything that
+ * arrives before it ends goes into the same log record: one page program
+ * per window however many updates there were. The erase ahead of the log
+ * (nand_log_reclaim) runs after the replies went out.
+ */
+
+/* mtd device */
+#define NAND_DATA_DEV       "/dev/mtd2"
+#define NAND_FLASH_OFFSET   0
+#define NAND_LOG_BLOCKS     4               /* same log region as the nand tool */
+#define NANDD_MAX_CLIENTS   32
+
+struct nandd_client
+{
+    int         fd;                         /* -1 when the slot is free */
+    bool        waiting;                    /* update or flush not answered yet, not polled meanwhile */
+};
+
+/* Options */
+static const char *device_name = NAND_DATA_DEV; /* mtd device, or simulator backing file */
+static const char *socket_path = NANDD_SOCKET;
+static uint64_t log_offset = NAND_FLASH_OFFSET;
+static uint32_t log_blocks = NAND_LOG_BLOCKS;
+static unsigned int window_ms = 100;        /* flush window, from the first pending update */
+static bool stats = false;                  /* print call counters as JSON to stderr on exit */
+
+static volatile sig_atomic_t quit = 0;
+
+static struct nandd_client clients[NANDD_MAX_CLIENTS];
+static nand_log_t plog;                     /* preserved data log */
+static uint8_t *record;                     /* newest record with the pending updates applied */
+static uint16_t record_len;
+static uint16_t record_max;                 /* payload that fits a log page */
+static bool dirty = false;                  /* record has updates not on flash yet */
+static uint64_t deadline;                   /* ms, end of the flush window while dirty */
+static uint64_t updates = 0, flushes = 0;
+
+static uint64_t now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    quit = 1;
+}
+
+static void reply(struct nandd_client *c, int32_t status, const void *data, uint16_t len)
+{
+    nandd_resp_t resp;
+
+    memset(&resp, 0, offsetof(nandd_resp_t, data));
+    resp.status = status;
+    resp.seq = plog.seq;
+    resp.len = len;
+    if (len)
+        memcpy(resp.data, data, len);
+    /* a client that went away is dropped by the next poll */
+    send(c->fd, &resp, offsetof(nandd_resp_t, data) + len, MSG_NOSIGNAL | MSG_DONTWAIT);
+    c->waiting = false;
+}
+
+/*
+ * One log record for everything pending, then the waiting clients get their
+ * answer. When the program fails they get -EIO, the record stays dirty and
+ * is tried again one window later, on the next page of the log.
+ */
+static int flush(void)
+{
+    int32_t status = 0;
+    unsigned int i;
+
+    if (nand_log_append(&plog, record, record_len) < 0) {
+        status = -EIO;
+        deadline = now_ms() + window_ms;
+        printf("nandd: programming the record failed, retried in %u ms\n", window_ms);
+    } else {
+        dirty = false;
+    }
+    flushes++;
+
+    for (i = 0; i < NANDD_MAX_CLIENTS; i++) {
+        if (clients[i].fd >= 0 && clients[i].waiting)
+            reply(&clients[i], status, NULL, 0);
+    }
+
+    /* updates failing here stay in the record and go out with the next flush */
+    if (status == 0 && nand_log_reclaim(&plog) < 0)
+        printf("nandd: erase ahead failed, retried after the next flush\n");
+    return status;
+}
+
+static void handle(struct nandd_client *c)
+{
+    nandd_req_t req;
+    ssize_t size;
+    uint16_t len;
+
+    size = recv(c->fd, &req, sizeof(req), MSG_DONTWAIT);
+    if (size < 0 && (errno == EAGAIN || errno == EINTR))
+        return;
+    if (size <= 0) {
+        close(c->fd);
+        c->fd = -1;
+        c->waiting = false;
+        return;
+    }
+
+    if (size < (ssize_t)offsetof(nandd_req_t, data) || req.len > NANDD_MAX_DATA) {
+        reply(c, -EINVAL, NULL, 0);
+        return;
+    }
+
+    switch (req.op) {
+    case NANDD_READ:
+        len = 0;
+        if (req.offset < record_len)
+            len = record_len - req.offset < req.len ? record_len - req.offset : req.len;
+        reply(c, 0, record + req.offset, len);
+        break;
+
+    case NANDD_UPDATE:
+        if (size != (ssize_t)(offsetof(nandd_req_t, data) + req.len) ||
+            (uint32_t)req.offset + req.len > record_max) {
+            reply(c, -EINVAL, NULL, 0);
+            break;
+        }
+        /* a record growing past its old end reads 0x00 in the gap, like a fresh one */
+        if (req.offset > record_len)
+            memset(record + record_len, 0, req.offset - record_len);
+        memcpy(record + req.offset, req.data, req.len);
+        if (req.offset + req.len > record_len)
+            record_len = req.offset + req.len;
+        updates++;
+        if (!dirty) {
+            dirty = true;
+            deadline = now_ms() + window_ms;
+        }
+        c->waiting = true;
+        break;
+
+    case NANDD_FLUSH:
+        if (!dirty) {
+            reply(c, 0, NULL, 0);
+            break;
+        }
+        deadline = now_ms();
+        c->waiting = true;
+        break;
+
+    default:
+        reply(c, -EINVAL, NULL, 0);
+        break;
+    }
+}
+
+static int listen_socket(void)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", socket_path) >= (int)sizeof(addr.sun_path)) {
+        printf("nandd: socket path %s too long\n", socket_path);
+        return -1;
+    }
+
+    fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        printf("nandd: socket failed, errno %d\n", errno);
+        return -1;
+    }
+    unlink(socket_path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, NANDD_MAX_CLIENTS) < 0) {
+        printf("nandd: listen on %s failed, errno %d\n", socket_path, errno);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void serve(int lfd)
+{
+    struct pollfd fds[NANDD_MAX_CLIENTS + 1];
+    struct nandd_client *polled[NANDD_MAX_CLIENTS + 1];
+    unsigned int i, n;
+    uint64_t now;
+    int timeout, fd;
+
+    while (!quit) {
+        n = 0;
+        fds[n].fd = lfd;
+        fds[n].events = POLLIN;
+        polled[n++] = NULL;
+        for (i = 0; i < NANDD_MAX_CLIENTS; i++) {
+            if (clients[i].fd >= 0 && !clients[i].waiting) {
+                fds[n].fd = clients[i].fd;
+                fds[n].events = POLLIN;
+                polled[n++] = &clients[i];
+            }
+        }
+
+        timeout = -1;
+        if (dirty) {
+            now = now_ms();
+            timeout = deadline > now ? (int)(deadline - now) : 0;
+        }
+
+        if (poll(fds, n, timeout) < 0) {
+            if (errno == EINTR)
+                continue;
+            printf("nandd: poll failed, errno %d\n", errno);
+            break;
+        }
+
+        if (dirty && now_ms() >= deadline)
+            flush();
+
+        for (i = 1; i < n; i++) {
+            if (fds[i].revents & (POLLIN | POLLHUP | POLLERR))
+                handle(polled[i]);
+        }
+
+        if (fds[0].revents & POLLIN) {
+            fd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC);
+            for (i = 0; fd >= 0 && i < NANDD_MAX_CLIENTS && clients[i].fd >= 0; i++)
+                ;
+            if (fd >= 0 && i == NANDD_MAX_CLIENTS) {
+                printf("nandd: more than %d clients, connection refused\n", NANDD_MAX_CLIENTS);
+                close(fd);
+            } else if (fd >= 0) {
+                clients[i].fd = fd;
+                clients[i].waiting = false;
+            }
+        }
+    }
+
+    /* nothing acknowledged is lost on a clean stop */
+    if (dirty && flush() < 0)
+        printf("nandd: updates since record %u are not on flash!\n", plog.seq);
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: nandd [-d mtd_dev | -s sim_image] [-B bbt_file] [-u socket] [-o log_offset] [-n log_blocks] [-w window_ms] [-S]\n");
+    exit(EXIT_FAILURE);
+}
+
+static void process_options(int argc, char *argv[])
+{
+    unsigned long val;
+    char *end;
+    int c;
+
+    while ((c = getopt(argc, argv, "d:s:B:u:o:n:w:S")) != -1) {
+        switch (c) {
+        case 'd':
+            device_name = optarg;
+            break;
+        case 's':
+            /* run against the file-backed simulator instead of the mtd device */
+            nand_set_dev_ops(&nand_sim_ops);
+            device_name = optarg;
+            break;
+        case 'B':
+            nand_set_bbt_cache(optarg);
+            break;
+        case 'u':
+            socket_path = optarg;
+            break;
+        case 'o':
+            log_offset = strtoull(optarg, NULL, 0);
+            break;
+        case 'n':
+            log_blocks = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'w':
+            /* garbage read as 0 would silently turn coalescing off */
+            errno = 0;
+            val = strtoul(optarg, &end, 0);
+            if (*optarg == '\0' || *optarg == '-' || *end != '\0' || errno != 0 || val > UINT_MAX)
+                usage();
+            window_ms = (unsigned int)val;
+            break;
+        case 'S':
+            stats = true;
+            break;
+        default:
+            usage();
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    struct sigaction sa;
+    nand_session_t *s;
+    unsigned int i;
+    int lfd, ret;
+
+    process_options(argc, argv);
+    if (stats)
+        nand_set_dev_ops(nand_stats_wrap(nand_get_dev_ops()));
+
+    s = nand_open(device_name);
+    if (s == NULL) {
+        printf("nandd: failed to open %s, exit!\n", device_name);
+        return EXIT_FAILURE;
+    }
+    if (nand_log_open(&plog, s, log_offset, log_blocks) < 0) {
+        printf("nandd: failed to open the preserved data log, exit!\n");
+        nand_close(s);
+        return EXIT_FAILURE;
+    }
+
+    record_max = s->meminfo.writesize - sizeof(nand_log_hdr_t) - sizeof(nand_log_wear_t);
+    record = (uint8_t *)calloc(1, record_max);
+    ret = record != NULL ? nand_log_read(&plog, record, record_max) : -1;
+    if (ret < 0) {
+        printf("nandd: failed to read the preserved data record, exit!\n");
+        free(record);
+        nand_close(s);
+        return EXIT_FAILURE;
+    }
+    record_len = ret;
+
+    for (i = 0; i < NANDD_MAX_CLIENTS; i++)
+        clients[i].fd = -1;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    lfd = listen_socket();
+    if (lfd < 0) {
+        free(record);
+        nand_close(s);
+        return EXIT_FAILURE;
+    }
+    printf("nandd: %s, record %u bytes (seq %u), window %u ms, listening on %s\n",
+           device_name, record_len, plog.seq, window_ms, socket_path);
+    fflush(stdout);
+
+    serve(lfd);
+
+    for (i = 0; i < NANDD_MAX_CLIENTS; i++) {
+        if (clients[i].fd >= 0)
+            close(clients[i].fd);
+    }
+    close(lfd);
+    unlink(socket_path);
+
+    printf("nandd: %llu updates in %llu flushes\n", (unsigned long long)updates, (unsigned long long)flushes);
+    if (stats)
+        nand_stats_report(stderr);
+    free(record);
+    nand_close(s);
+    return 0;
+}
@@ -0,0 +1,64 @@
+#ifndef NANDD_H
+#define NANDD_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Request API of nandd, the preserved data daemon.
+ *
+ * nandd keeps one session and the record log of nand_log.h open, and the
+ * newest record in RAM. Components read and update byte ranges of that
+ * record over a local SOCK_SEQPACKET Unix socket, one message per request
+ * and one per reply. Reads are answered from RAM. Updates are merged into
+ * the record in RAM; the first one starts the flush window, and when it
+ * ends the record is programmed as a single log record. Every update of
+ * the window is answered after that program, so status 0 means the data
+ * is on flash. -EIO means the program failed: the update stays in the
+ * record, which is programmed again one window later.
+ */
+
+#define NANDD_SOCKET        "/tmp/nandd.sock"
+#define NANDD_MAX_DATA      2048            /* data bytes in one request or reply */
+
+enum nandd_op
+{
+    NANDD_READ = 1,                         /* bytes offset..offset+len of the record */
+    NANDD_UPDATE,                           /* replace them, the record grows as needed */
+    NANDD_FLUSH                             /* program pending updates now */
+};
+
+typedef struct nandd_req
+{
+    uint16_t    op;                         /* NANDD_* */
+    uint16_t    offset;                     /* byte range of the record */
+    uint16_t    len;
+    uint16_t    reserved;
+    uint8_t     data[NANDD_MAX_DATA];       /* NANDD_UPDATE only, len bytes are sent */
+}nandd_req_t;
+
+typedef struct nandd_resp
+{
+    int32_t     status;                     /* 0 or -errno */
+    uint32_t    seq;                        /* log record holding the data, nand_log_t seq */
+    uint16_t    len;                        /* NANDD_READ: data bytes, 0 past the end of the record */
+    uint16_t    reserved;
+    uint8_t     data[NANDD_MAX_DATA];
+}nandd_resp_t;
+
+/* client side, in libnand. -1 with errno set on errors, status errors included */
+int nandd_connect(const char *path);
+/* bytes copied, fewer than len at the end of the record */
+int nandd_read(int fd, uint16_t offset, void *data, uint16_t len);
+/* returns once the record holding the update is programmed */
+int nandd_update(int fd, uint16_t offset, const void *data, uint16_t len);
+int nandd_flush(int fd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,103 @@
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "nandd.h"
+
+int nandd_connect(const char *path)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path) >= (int)sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* one request, one reply; the reply length is checked against what it claims */
+static int nandd_call(int fd, nandd_req_t *req, nandd_resp_t *resp)
+{
+    size_t len = offsetof(nandd_req_t, data) + (req->op == NANDD_UPDATE ? req->len : 0);
+    ssize_t size;
+
+    if (send(fd, req, len, MSG_NOSIGNAL) != (ssize_t)len)
+        return -1;
+    do {
+        size = recv(fd, resp, sizeof(*resp), 0);
+    } while (size < 0 && errno == EINTR);
+    if (size < (ssize_t)offsetof(nandd_resp_t, data) || size < (ssize_t)offsetof(nandd_resp_t, data) + resp->len) {
+        if (size >= 0)
+            errno = EPROTO;
+        return -1;
+    }
+    if (resp->status < 0) {
+        errno = -resp->status;
+        return -1;
+    }
+    return 0;
+}
+
+int nandd_read(int fd, uint16_t offset, void *data, uint16_t len)
+{
+    nandd_req_t req;
+    nandd_resp_t resp;
+
+    if (len > NANDD_MAX_DATA) {
+        errno = EINVAL;
+        return -1;
+    }
+    memset(&req, 0, offsetof(nandd_req_t, data));
+    req.op = NANDD_READ;
+    req.offset = offset;
+    req.len = len;
+    if (nandd_call(fd, &req, &resp) < 0)
+        return -1;
+    if (resp.len > len) {
+        errno = EPROTO;
+        return -1;
+    }
+    memcpy(data, resp.data, resp.len);
+    return resp.len;
+}
+
+int nandd_update(int fd, uint16_t offset, const void *data, uint16_t len)
+{
+    nandd_req_t req;
+    nandd_resp_t resp;
+
+    if (len > NANDD_MAX_DATA) {
+        errno = EINVAL;
+        return -1;
+    }
+    memset(&req, 0, offsetof(nandd_req_t, data));
+    req.op = NANDD_UPDATE;
+    req.offset = offset;
+    req.len = len;
+    memcpy(req.data, data, len);
+    return nandd_call(fd, &req, &resp);
+}
+
+int nandd_flush(int fd)
+{
+    nandd_req_t req;
+    nandd_resp_t resp;
+
+    memset(&req, 0, offsetof(nandd_req_t, data));
+    req.op = NANDD_FLUSH;
+    return nandd_call(fd, &req, &resp);
+}